@@ -0,0 +1,339 @@
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <asyncio.hpp>
+#include <spdlog/spdlog.h>
+
+#include "tinyrpc.hpp"
+#include "tinyrpc/deadline_timer.hpp"
+#include "histogram.hpp"
+#ifdef TINYRPC_ENABLE_PROTOBUF
+#include "bench/bench.pb.h"
+#endif
+
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr const char* usage = R"(usage: tinyrpc_bench [server|client|local] [options]
+  server   run the bundled echo/compute server only
+  client   load an already running server
+  local    run both in one process (default)
+options:
+  --host HOST          unix:PATH for a unix domain socket (127.0.0.1)
+  --port PORT          (23333)
+  --loops N            server event loops (1)
+  --threads N          client threads, connections are spread over them (1)
+  --connections N      client connections (1)
+  --concurrency N      closed loop: calls in flight per connection (1)
+  --rate QPS           open loop: total request rate, 0 for closed loop (0)
+  --payload BYTES      request payload size (64)
+  --duration SECONDS   measured time (10)
+  --warmup SECONDS     time before measuring (1)
+  --method NAME        echo or compute (echo)
+  --codec NAME         msgpack or protobuf (msgpack)
+)";
+
+struct Options {
+    std::string mode { "local" };
+    std::string host { "127.0.0.1" };
+    short port { 23333 };
+    size_t loops { 1 };
+    size_t threads { 1 };
+    size_t connections { 1 };
+    size_t concurrency { 1 };
+    double rate { 0 };
+    size_t payload { 64 };
+    double duration { 10 };
+    double warmup { 1 };
+    std::string method { "echo" };
+    std::string codec { "msgpack" };
+};
+
+/// results of one client thread, merged once all are done
+struct Stats {
+    Histogram latency {};
+    uint64_t errors { 0 };
+};
+
+
+template<typename T>
+static bool parse_number(std::string_view s, T& out) {
+    auto [p, ec] = std::from_chars(s.data(), s.data()+s.size(), out);
+    return ec == std::errc() && p == s.data()+s.size();
+}
+
+static bool parse_options(int argc, char** argv, Options& opt) {
+    int i = 1;
+    if (i < argc && argv[i][0] != '-') {
+        opt.mode = argv[i++];
+    }
+    for (; i+1 < argc; i += 2) {
+        std::string_view key = argv[i], value = argv[i+1];
+        bool ok = true;
+        if (key == "--host") opt.host = value;
+        else if (key == "--port") ok = parse_number(value, opt.port);
+        else if (key == "--loops") ok = parse_number(value, opt.loops);
+        else if (key == "--threads") ok = parse_number(value, opt.threads);
+        else if (key == "--connections") ok = parse_number(value, opt.connections);
+        else if (key == "--concurrency") ok = parse_number(value, opt.concurrency);
+        else if (key == "--rate") ok = parse_number(value, opt.rate);
+        else if (key == "--payload") ok = parse_number(value, opt.payload);
+        else if (key == "--duration") ok = parse_number(value, opt.duration);
+        else if (key == "--warmup") ok = parse_number(value, opt.warmup);
+        else if (key == "--method") opt.method = value;
+        else if (key == "--codec") opt.codec = value;
+        else ok = false;
+        if (!ok) {
+            std::fprintf(stderr, "invalid option %s %s\n", argv[i], argv[i+1]);
+            return false;
+        }
+    }
+    if (i != argc
+        || (opt.mode != "server" && opt.mode != "client" && opt.mode != "local")
+        || (opt.method != "echo" && opt.method != "compute")
+        || (opt.codec != "msgpack" && opt.codec != "protobuf")) {
+        return false;
+    }
+#ifndef TINYRPC_ENABLE_PROTOBUF
+    if (opt.codec == "protobuf") {
+        std::fprintf(stderr, "built without protobuf\n");
+        return false;
+    }
+#endif
+    opt.threads = std::clamp<size_t>(opt.threads, 1, std::max<size_t>(opt.connections, 1));
+    return opt.connections > 0 && opt.concurrency > 0;
+}
+
+
+/// cpu bound work proportional to the payload, FNV-1a over it 16 times
+static uint64_t compute(std::string_view data) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int round = 0; round < 16; ++round) {
+        for (auto c : data) {
+            hash = (hash ^ (unsigned char)c) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static std::string echo(const std::string& data) {
+    return data;
+}
+
+static uint64_t compute_string(const std::string& data) {
+    return compute(data);
+}
+
+#ifdef TINYRPC_ENABLE_PROTOBUF
+static bench::Payload echo_proto(const bench::Payload& msg) {
+    return msg;
+}
+
+static bench::Result compute_proto(const bench::Payload& msg) {
+    bench::Result res;
+    res.set_hash(compute(msg.data()));
+    return res;
+}
+#endif
+
+static void run_server(const Options& opt) {
+    TINYRPC_NS::Server server;
+    server.init(opt.host.c_str(), opt.port, 1024);
+    TINYRPC_NS::register_func(server, "echo", echo);
+    TINYRPC_NS::register_func(server, "compute", compute_string);
+#ifdef TINYRPC_ENABLE_PROTOBUF
+    TINYRPC_NS::register_func(server, "echo_proto", echo_proto);
+    TINYRPC_NS::register_func(server, "compute_proto", compute_proto);
+#endif
+    server.serve(opt.loops);
+}
+
+
+/// one call of the configured kind, false on error
+static ASYNCIO_NS::Task<bool> call_once(TINYRPC_NS::Client& client, const Options& opt, const std::string& payload) {
+#ifdef TINYRPC_ENABLE_PROTOBUF
+    if (opt.codec == "protobuf") {
+        bench::Payload msg;
+        msg.set_data(payload);
+        if (opt.method == "echo") {
+            co_return (co_await TINYRPC_NS::call_func<bench::Payload>(client, "echo_proto", msg)).has_value();
+        }
+        co_return (co_await TINYRPC_NS::call_func<bench::Result>(client, "compute_proto", msg)).has_value();
+    }
+#endif
+    if (opt.method == "echo") {
+        co_return (co_await TINYRPC_NS::call_func<std::string>(client, "echo", payload)).has_value();
+    }
+    co_return (co_await TINYRPC_NS::call_func<uint64_t>(client, "compute", payload)).has_value();
+}
+
+static inline void record(Stats& stats, Clock::time_point start, Clock::time_point measure_from, bool ok) {
+    if (start < measure_from) {
+        return;
+    }
+    if (!ok) {
+        ++stats.errors;
+        return;
+    }
+    stats.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-start).count());
+}
+
+/// keeps one call in flight at all times
+static ASYNCIO_NS::Task<> closed_loop(
+    TINYRPC_NS::Client& client,
+    const Options& opt,
+    const std::string& payload,
+    Stats& stats,
+    Clock::time_point measure_from,
+    Clock::time_point end
+) {
+    while (Clock::now() < end) {
+        auto start = Clock::now();
+        auto ok = co_await call_once(client, opt, payload);
+        record(stats, start, measure_from, ok);
+    }
+}
+
+static ASYNCIO_NS::Task<> timed_call(
+    TINYRPC_NS::Client& client,
+    const Options& opt,
+    const std::string& payload,
+    Stats& stats,
+    Clock::time_point intended,
+    Clock::time_point measure_from,
+    size_t& outstanding,
+    ASYNCIO_NS::Event<>& done
+) {
+    auto ok = co_await call_once(client, opt, payload);
+    // measured from when the call was due, so a stalled server is not
+    // hidden by sending less (coordinated omission)
+    record(stats, intended, measure_from, ok);
+    if (--outstanding == 0 && !done.is_set()) {
+        done.set();
+    }
+}
+
+/// sends at a fixed rate whatever the latency
+static ASYNCIO_NS::Task<> open_loop(
+    TINYRPC_NS::Client& client,
+    const Options& opt,
+    const std::string& payload,
+    Stats& stats,
+    double rate,
+    Clock::time_point measure_from,
+    Clock::time_point end
+) {
+    TINYRPC_NS::DeadlineTimer timer;
+    ASYNCIO_NS::Event<> tick;
+    ASYNCIO_NS::Event<> done;
+    size_t outstanding = 1;
+    auto interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1 / rate));
+    auto next = Clock::now();
+    while (next < end) {
+        {
+            // everything due is sent in one flush
+            auto batch = client.batch();
+            for (auto now = Clock::now(); next <= now && next < end; next += interval) {
+                ++outstanding;
+                timed_call(client, opt, payload, stats, next, measure_from, outstanding, done);
+            }
+        }
+        timer.schedule(next, [&tick] { tick.set(); });
+        co_await tick.wait();
+    }
+    if (--outstanding > 0) {
+        co_await done.wait();
+    }
+}
+
+static ASYNCIO_NS::Task<> client_thread(const Options& opt, size_t connections, Stats& stats) {
+    std::string payload(opt.payload, 'x');
+    std::vector<TINYRPC_NS::Client> clients(connections);
+    for (auto& client : clients) {
+        if (!co_await client.connect(opt.host.c_str(), opt.port)) {
+            std::exit(EXIT_FAILURE);
+        }
+        co_await client.fetch_method_table();
+    }
+    auto measure_from = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.warmup));
+    auto end = measure_from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opt.duration));
+    std::vector<ASYNCIO_NS::Task<>> tasks;
+    for (auto& client : clients) {
+        if (opt.rate > 0) {
+            tasks.push_back(open_loop(client, opt, payload, stats, opt.rate / opt.connections, measure_from, end));
+            continue;
+        }
+        for (size_t i = 0; i < opt.concurrency; ++i) {
+            tasks.push_back(closed_loop(client, opt, payload, stats, measure_from, end));
+        }
+    }
+    for (auto& task : tasks) {
+        co_await std::move(task);
+    }
+}
+
+static void report(const Options& opt, const Stats& stats) {
+    auto& h = stats.latency;
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    std::printf(
+        "%s/%s %s loop, %zu connections, payload %zu bytes, %.1fs\n",
+        opt.method.c_str(),
+        opt.codec.c_str(),
+        opt.rate > 0 ? "open" : "closed",
+        opt.connections,
+        opt.payload,
+        opt.duration
+    );
+    std::printf("requests %llu, errors %llu, qps %.0f\n",
+        (unsigned long long)h.count(), (unsigned long long)stats.errors, h.count() / opt.duration);
+    std::printf("latency us: min %.1f mean %.1f p50 %.1f p99 %.1f p999 %.1f max %.1f\n",
+        us(h.min()), h.mean() / 1000, us(h.percentile(0.5)), us(h.percentile(0.99)),
+        us(h.percentile(0.999)), us(h.max()));
+}
+
+static void run_client(const Options& opt) {
+    std::vector<Stats> stats(opt.threads);
+    std::vector<std::jthread> threads;
+    for (size_t i = 0; i < opt.threads; ++i) {
+        // spread connections evenly, the first threads take the remainder
+        auto connections = opt.connections / opt.threads + (i < opt.connections % opt.threads);
+        threads.emplace_back([&opt, &stats, i, connections] {
+            ASYNCIO_NS::run(client_thread(opt, connections, stats[i]));
+        });
+    }
+    threads.clear();
+    Stats total;
+    for (auto& s : stats) {
+        total.latency.merge(s.latency);
+        total.errors += s.errors;
+    }
+    report(opt, total);
+}
+
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::fputs(usage, stderr);
+        return EXIT_FAILURE;
+    }
+    spdlog::set_level(spdlog::level::warn);
+    if (opt.mode == "server") {
+        run_server(opt);
+        return 0;
+    }
+    if (opt.mode == "local") {
+        std::thread([&opt] { run_server(opt); }).detach();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    run_client(opt);
+    // the local server never returns
+    std::fflush(stdout);
+    std::_Exit(0);
+}
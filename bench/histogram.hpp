@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+
+/// HDR style latency histogram
+///
+/// values are bucketed log-linearly: each power of two range is split into
+/// 2^precision equal sub buckets, so every recorded value is kept with a
+/// relative error below 2^-precision while the histogram stays a few
+/// kilobytes whatever the range. Recording is a couple of shifts and an
+/// increment.
+class Histogram {
+public:
+    static constexpr unsigned precision = 7;
+    static constexpr uint64_t sub_buckets = uint64_t(1) << precision;
+
+    Histogram(): _counts((64-precision+1)*sub_buckets, 0) {}
+
+    inline void record(uint64_t value) noexcept {
+        ++_counts[index(value)];
+        ++_count;
+        _sum += value;
+        _min = std::min(_min, value);
+        _max = std::max(_max, value);
+    }
+
+    void merge(const Histogram& other) noexcept {
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            _counts[i] += other._counts[i];
+        }
+        _count += other._count;
+        _sum += other._sum;
+        _min = std::min(_min, other._min);
+        _max = std::max(_max, other._max);
+    }
+
+    inline uint64_t count() const noexcept { return _count; }
+    inline uint64_t min() const noexcept { return _count ? _min : 0; }
+    inline uint64_t max() const noexcept { return _max; }
+    inline double mean() const noexcept { return _count ? double(_sum) / _count : 0; }
+
+    /// smallest value at or above which lies (1 - q) of the recorded ones,
+    /// q in [0, 1], reported as the upper bound of its bucket
+    uint64_t percentile(double q) const noexcept {
+        if (_count == 0) {
+            return 0;
+        }
+        auto rank = std::max<uint64_t>(1, uint64_t(q * _count + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < _counts.size(); ++i) {
+            seen += _counts[i];
+            if (seen >= rank) {
+                return std::min(upper_bound(i), _max);
+            }
+        }
+        return _max;
+    }
+private:
+    std::vector<uint64_t> _counts;
+    uint64_t _count { 0 };
+    uint64_t _sum { 0 };
+    uint64_t _min { std::numeric_limits<uint64_t>::max() };
+    uint64_t _max { 0 };
+
+    /// values below sub_buckets map one to one, above that the top
+    /// precision+1 bits select the bucket within their power of two
+    static inline size_t index(uint64_t value) noexcept {
+        if (value < sub_buckets) {
+            return value;
+        }
+        unsigned shift = std::bit_width(value) - precision - 1;
+        return (shift+1)*sub_buckets + ((value >> shift) - sub_buckets);
+    }
+
+    static inline uint64_t upper_bound(size_t index) noexcept {
+        if (index < sub_buckets) {
+            return index;
+        }
+        unsigned shift = index / sub_buckets - 1;
+        uint64_t base = (index % sub_buckets + sub_buckets) << shift;
+        return base + ((uint64_t(1) << shift) - 1);
+    }
+};
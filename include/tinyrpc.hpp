@@ -1,143 +1,291 @@
 #pragma once
+#include <chrono>
+#include <expected>
+#include <ranges>
+#include <tuple>
+#include <vector>
+
 #include <msgpack.hpp>
 
 #include "tinyrpc_ns.hpp"
 #include "tinyrpc/utils.hpp"
+#include "tinyrpc/arena.hpp"
+#include "tinyrpc/codec/msgpack_reader.hpp"
+#include "tinyrpc/metrics.hpp"
 #include "tinyrpc/server.hpp"
 #include "tinyrpc/client.hpp"
 #include "tinyrpc/wrapped_buffer.hpp"
 
 
+TINYRPC_NS_BEGIN(utils)
+
+/// serialize the result of a registered function, messages may be returned
+/// by pointer when they are built on the arena of the request
+template<typename R>
+void write_result(const R& res, GrowableBuffer& out) noexcept {
+    WrappedBuffer buf(out);
+    if constexpr (concepts::ProtoType<R>) {
+        res.SerializeToZeroCopyStream(&buf);
+    } else if constexpr (std::is_pointer_v<R> && concepts::ProtoType<proto_message_t<R>>) {
+        if (res) {
+            res->SerializeToZeroCopyStream(&buf);
+        }
+    } else {
+        msgpack::pack(buf, res);
+    }
+}
+
+/// if in-process clients may pass the decayed arguments of a function with
+/// raw parameters Raw and result R straight to it, messages on the arena of
+/// the request rule that out
+template<typename Raw, typename R>
+constexpr bool direct_callable = [] {
+    if constexpr (std::tuple_size_v<Raw> == 0) {
+        return !std::is_pointer_v<R>;
+    } else if constexpr (is_proto_args<Raw>) {
+        return !uses_arena<Raw, R>;
+    } else {
+        return !std::is_pointer_v<R>;
+    }
+}();
+
+TINYRPC_NS_END
+
+
 TINYRPC_NS_BEGIN()
 
+/// execution chooses where sync functions run, see Execution
+///
+/// msgpack arguments are decoded straight from the request body, arguments
+/// of type std::string_view or std::span<const char> view into it and stay
+/// valid until the function returns. Requests whose arguments do not decode,
+/// msgpack or protobuf, fail with RPCError::BadRequest without calling func.
+///
+/// a protobuf argument taken by pointer or reference is parsed onto an arena
+/// pooled per thread, as is the result if func takes the arena as second
+/// parameter and returns the message by pointer, both are freed once the
+/// response is serialized.
+///
+/// in-process clients passing the decayed parameter types and expecting
+/// the result type of func call it without encoding either, see
+/// Client::connect(LocalEndpoint&). Their other calls still encode the
+/// request and copy the response out, only sockets and framing are skipped.
+/// Unless func runs on the worker pool it runs on the thread of such a
+/// client, concurrently with the event loops of the server.
+///
+/// with cache enabled a request whose body equals an earlier one is
+/// answered with the earlier response until its ttl passed, func has to
+/// be free of side effects then.
 template<typename F>
-void register_func(Server& server, const std::string& name, F&& func) noexcept {
+void register_func(
+    Server& server,
+    const std::string& name,
+    F&& func,
+    Execution execution = Execution::Inline,
+    CachePolicy cache = {}
+) noexcept {
     using traits = utils::function_traits<std::decay_t<F>>;
     using return_type = traits::return_type;
     using args_type = traits::args_type;
+    using raw_args_type = traits::raw_args_type;
     if constexpr (utils::is_async_task_v<return_type>) {
         using return_type = return_type::result_type;
-        server.register_afunc(name, [f = std::forward<F>(func)](Message&& msg, GrowableBuffer& out) -> ASYNCIO_NS::Task<> {
+        // a copy, func is a function pointer or std::function
+        auto wire = [f = func](Message&& msg, GrowableBuffer& out) -> ASYNCIO_NS::Task<bool> {
             auto buffer = msg.body();
             if constexpr (std::tuple_size_v<args_type> == 0) {
                 if constexpr (std::is_void_v<return_type>) {
                     co_await f();
                 } else {
                     auto res = co_await f();
-                    WrappedBuffer buf(out);
-                    if constexpr (concepts::ProtoType<return_type>) {
-                        res.SerializeToZeroCopyStream(&buf);
-                    } else {
-                        msgpack::pack(buf, res);
-                    }
+                    utils::write_result(res, out);
+                }
+            } else if constexpr (utils::is_proto_args<raw_args_type>) {
+                // held across the call and serializing its result
+                auto arena = utils::request_arena<raw_args_type, return_type>();
+                auto arg = utils::parse_proto<raw_args_type>(buffer, arena.get());
+                if (!arg) {
+                    co_return false;
+                }
+                if constexpr (std::is_void_v<return_type>) {
+                    co_await utils::call_proto<raw_args_type>(f, *arg, arena.get());
+                } else {
+                    auto res = co_await utils::call_proto<raw_args_type>(f, *arg, arena.get());
+                    utils::write_result(res, out);
                 }
             } else {
+                args_type args;
+                if (!codec::decode(buffer, args)) {
+                    co_return false;
+                }
                 if constexpr (std::is_void_v<return_type>) {
-                    if constexpr (utils::is_proto_args<args_type>) {
-                        std::decay_t<decltype(std::get<0>(*(args_type*)nullptr))> arg;
-                        arg.ParseFromArray(buffer.data(), buffer.size());
-                        co_await f(std::move(arg));
-                    } else {
-                        args_type args;
-                        msgpack::unpack(buffer.data(), buffer.size()).get().convert(args);
-                        co_await utils::expand_tuple_call(f, std::move(args));
-                    }
+                    co_await utils::expand_tuple_call(f, std::move(args));
                 } else {
-                    return_type res;
-                    if constexpr (utils::is_proto_args<args_type>) {
-                        std::decay_t<decltype(std::get<0>(*(args_type*)nullptr))> arg;
-                        arg.ParseFromArray(buffer.data(), buffer.size());
-                        res = co_await f(std::move(arg));
-                    } else {
-                        args_type args;
-                        msgpack::unpack(buffer.data(), buffer.size()).get().convert(args);
-                        res = co_await utils::expand_tuple_call(f, std::move(args));
-                    }
-                    WrappedBuffer buf(out);
-                    if constexpr (concepts::ProtoType<return_type>) {
-                        res.SerializeToZeroCopyStream(&buf);
-                    } else {
-                        msgpack::pack(buf, res);
-                    }
+                    auto res = co_await utils::expand_tuple_call(f, std::move(args));
+                    utils::write_result(res, out);
                 }
             }
-        });
+            co_return true;
+        };
+        if constexpr (utils::direct_callable<raw_args_type, return_type>) {
+            auto direct = [f = std::forward<F>(func)](DirectCall call) -> ASYNCIO_NS::Task<> {
+                auto& args = *(args_type*)call.args;
+                if constexpr (std::is_void_v<return_type>) {
+                    co_await utils::expand_tuple_call(f, std::move(args));
+                } else {
+                    *(return_type*)call.result = co_await utils::expand_tuple_call(f, std::move(args));
+                }
+            };
+            auto& signature = typeid(Signature<args_type, return_type>);
+            server.register_handler(name, Handler::async(utils::overloaded { std::move(wire), std::move(direct) }, signature), execution, cache);
+        } else {
+            server.register_handler(name, Handler::async(std::move(wire)), execution, cache);
+        }
     } else {
-        server.register_func(name, [f = std::forward<F>(func)](Message&& msg, GrowableBuffer& out) {
+        auto wire = [f = func](Message&& msg, GrowableBuffer& out) -> bool {
             auto buffer = msg.body();
             if constexpr (std::tuple_size_v<args_type> == 0) {
                 if constexpr (std::is_void_v<return_type>) {
                     f();
                 } else {
                     auto res = f();
-                    WrappedBuffer buf(out);
-                    if constexpr (concepts::ProtoType<return_type>) {
-                        res.SerializeToZeroCopyStream(&buf);
-                    } else {
-                        msgpack::pack(buf, res);
-                    }
+                    utils::write_result(res, out);
+                }
+            } else if constexpr (utils::is_proto_args<raw_args_type>) {
+                auto arena = utils::request_arena<raw_args_type, return_type>();
+                auto arg = utils::parse_proto<raw_args_type>(buffer, arena.get());
+                if (!arg) {
+                    return false;
+                }
+                if constexpr (std::is_void_v<return_type>) {
+                    utils::call_proto<raw_args_type>(f, *arg, arena.get());
+                } else {
+                    auto res = utils::call_proto<raw_args_type>(f, *arg, arena.get());
+                    utils::write_result(res, out);
                 }
             } else {
+                args_type args;
+                if (!codec::decode(buffer, args)) {
+                    return false;
+                }
                 if constexpr (std::is_void_v<return_type>) {
-                    if constexpr (utils::is_proto_args<args_type>) {
-                        std::decay_t<decltype(std::get<0>(*(args_type*)nullptr))> arg;
-                        arg.ParseFromArray(buffer.data(), buffer.size());
-                        f(std::move(arg));
-                    } else {
-                        args_type args;
-                        msgpack::unpack(buffer.data(), buffer.size()).get().convert(args);
-                        utils::expand_tuple_call(f, std::move(args));
-                    }
+                    utils::expand_tuple_call(f, std::move(args));
                 } else {
-                    return_type res;
-                    if constexpr (utils::is_proto_args<args_type>) {
-                        std::decay_t<decltype(std::get<0>(*(args_type*)nullptr))> arg;
-                        arg.ParseFromArray(buffer.data(), buffer.size());
-                        res = f(std::move(arg));
-                    } else {
-                        args_type args;
-                        msgpack::unpack(buffer.data(), buffer.size()).get().convert(args);
-                        res = utils::expand_tuple_call(f, std::move(args));
-                    }
-                    WrappedBuffer buf(out);
-                    if constexpr (concepts::ProtoType<return_type>) {
-                        res.SerializeToZeroCopyStream(&buf);
-                    } else {
-                        msgpack::pack(buf, res);
-                    }
+                    auto res = utils::expand_tuple_call(f, std::move(args));
+                    utils::write_result(res, out);
                 }
             }
-        });
+            return true;
+        };
+        if constexpr (utils::direct_callable<raw_args_type, return_type>) {
+            auto direct = [f = std::forward<F>(func)](DirectCall call) {
+                auto& args = *(args_type*)call.args;
+                if constexpr (std::is_void_v<return_type>) {
+                    utils::expand_tuple_call(f, std::move(args));
+                } else {
+                    *(return_type*)call.result = utils::expand_tuple_call(f, std::move(args));
+                }
+            };
+            auto& signature = typeid(Signature<args_type, return_type>);
+            server.register_handler(name, Handler::sync(utils::overloaded { std::move(wire), std::move(direct) }, signature), execution, cache);
+        } else {
+            server.register_handler(name, Handler::sync(std::move(wire)), execution, cache);
+        }
     }
 }
 
 
+/// fails with RPCError::Timeout if no response arrived within timeout,
+/// with RPCError::DecodeError if the response is no R
+///
+/// a client connected in process passes the arguments and result straight
+/// through if the function takes and returns exactly these types
 template<typename R, typename... Args>
-asyncio::Task<R, RPCError> call_func(Client& client, std::string_view name, Args&&... args) {
-    GrowableBuffer data;
-    WrappedBuffer buf(data);
-    if constexpr (sizeof...(Args) > 0) {
-        if constexpr (utils::is_proto_args<Args...>) {
-            decltype(auto) arg = utils::get_first_arg(args...);
-            arg.SerializeToZeroCopyStream(&buf);
+asyncio::Task<R, RPCError> call_func(Client& client, std::chrono::milliseconds timeout, std::string_view name, Args&&... args) {
+    static_assert(!codec::Borrowed<R>, "results outlive the response, they cannot view into it");
+    using args_type = std::tuple<std::decay_t<Args>...>;
+    if (auto method = client.find_direct(name, typeid(Signature<args_type, R>)); method) {
+        // built before suspending, arguments are moved from if they can be
+        args_type args_ { std::forward<Args>(args)... };
+        if constexpr (std::is_void_v<R>) {
+            co_await client.call_direct(*method, { &args_, nullptr });
+            co_return std::expected<void, RPCError> {};
         } else {
-            std::tuple<std::decay_t<Args>...> args_ { std::forward<Args>(args)... };
-            msgpack::pack(buf, args_);
+            R res;
+            co_await client.call_direct(*method, { &args_, &res });
+            co_return std::move(res);
         }
     }
-    co_return (co_await client.call(name, data.read_all()))
-    .transform([](Message&& msg) -> R {
-        auto body = msg.body();
-        if constexpr (!std::is_void_v<R>) {
-            R res;
-            if constexpr (concepts::ProtoType<R>) {
-                res.ParseFromArray(body.data(), body.size());
+    // serialized straight behind the request header
+    auto request = client.call(name, [&](GrowableBuffer& out) {
+        if constexpr (sizeof...(Args) > 0) {
+            WrappedBuffer buf(out);
+            if constexpr (utils::is_proto_args<Args...>) {
+                decltype(auto) arg = utils::get_first_arg(args...);
+                if constexpr (std::is_pointer_v<std::decay_t<decltype(arg)>>) {
+                    arg->SerializeToZeroCopyStream(&buf);
+                } else {
+                    arg.SerializeToZeroCopyStream(&buf);
+                }
             } else {
-                res = msgpack::unpack(body.data(), body.size())->convert();
+                std::tuple<const std::decay_t<Args>&...> args_ { args... };
+                msgpack::pack(buf, args_);
             }
-            return res;
         }
-    });
+    }, timeout);
+    auto msg = co_await std::move(request);
+    if (!msg) {
+        co_return msg.error();
+    }
+    if constexpr (std::is_void_v<R>) {
+        co_return std::expected<void, RPCError> {};
+    } else {
+        auto body = msg->body();
+        R res;
+        bool decoded;
+        if constexpr (concepts::ProtoType<R>) {
+            decoded = res.ParseFromArray(body.data(), body.size());
+        } else {
+            decoded = codec::decode(body, res);
+        }
+        if (!decoded) {
+            co_return RPCError::DecodeError;
+        }
+        co_return std::move(res);
+    }
+}
+
+template<typename R, typename... Args>
+asyncio::Task<R, RPCError> call_func(Client& client, std::string_view name, Args&&... args) {
+    // arguments are serialized before the task first suspends
+    return call_func<R>(client, std::chrono::milliseconds {}, name, std::forward<Args>(args)...);
+}
+
+/// call name once per element of args_list within one batch, so that all
+/// requests leave in a single flush. Elements are tuples of arguments or a
+/// single argument, results are in the order of args_list.
+template<typename R, std::ranges::input_range Range>
+std::vector<asyncio::Task<R, RPCError>> call_many(
+    Client& client,
+    std::string_view name,
+    Range&& args_list,
+    std::chrono::milliseconds timeout = {}
+) noexcept {
+    std::vector<asyncio::Task<R, RPCError>> calls;
+    if constexpr (std::ranges::sized_range<Range>) {
+        calls.reserve(std::ranges::size(args_list));
+    }
+    auto batch = client.batch();
+    for (auto&& args : args_list) {
+        if constexpr (concepts::TupleLike<decltype(args)>) {
+            calls.push_back(std::apply([&](auto&&... a) {
+                return call_func<R>(client, timeout, name, a...);
+            }, args));
+        } else {
+            calls.push_back(call_func<R>(client, timeout, name, args));
+        }
+    }
+    return calls;
 }
 
 TINYRPC_NS_END
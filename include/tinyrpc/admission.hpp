@@ -0,0 +1,87 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "tinyrpc_config.hpp"
+#include "tinyrpc_export.hpp"
+#include "./message.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// load shedding of a server, see AdmissionControl
+struct AdmissionOptions {
+    /// queue delay tolerated while overloaded, 0, the default, disables
+    /// shedding by delay
+    std::chrono::milliseconds target { TINYRPC_QUEUE_DELAY_TARGET_MS };
+    /// a loop is overloaded once no request of a whole interval waited less
+    /// than target
+    std::chrono::milliseconds interval { TINYRPC_QUEUE_DELAY_INTERVAL_MS };
+};
+
+/// decides per event loop which requests run and which are answered with
+/// an overloaded frame right away
+///
+/// the queue delay of a request is the time from reading it until it is
+/// dispatched, or until a worker picks it up. Like CoDel a loop only counts
+/// as overloaded once the delay stayed above target for a whole interval,
+/// so bursts pass and a standing queue does not. While overloaded requests
+/// that waited longer than target are shed, otherwise none are. Shedding
+/// is opt-in, see AdmissionOptions::target. Functions may limit their
+/// calls running at once as well, see Server::limit.
+class TINYRPC_EXPORT AdmissionControl {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// an admitted call, releases its slot of the function once destroyed
+    class Ticket {
+    public:
+        Ticket(Ticket&) = delete;
+        inline Ticket(Ticket&& t) noexcept: _control(std::exchange(t._control, nullptr)), _method(t._method) {}
+        Ticket& operator=(Ticket&) = delete;
+        Ticket& operator=(Ticket&&) = delete;
+        inline ~Ticket() noexcept {
+            if (_control) _control->release(_method);
+        }
+    private:
+        friend class AdmissionControl;
+        AdmissionControl* _control;
+        Message::MethodID _method;
+
+        inline Ticket(AdmissionControl* control, Message::MethodID method) noexcept:
+            _control(control), _method(method) {}
+    };
+
+    /// methods: size of the frozen dispatch table
+    AdmissionControl(const AdmissionOptions& options, size_t methods) noexcept:
+        _options(options), _running(methods, 0) {}
+    AdmissionControl(AdmissionControl&) = delete;
+    AdmissionControl& operator=(AdmissionControl&) = delete;
+
+    /// a ticket if a call of method, limited to max_running calls at once or
+    /// unlimited if 0, that waited delay may run
+    std::optional<Ticket> admit(
+        Message::MethodID method,
+        size_t max_running,
+        Clock::duration delay,
+        Clock::time_point now
+    ) noexcept;
+    /// account for the delay of a request admitted before it waited on
+    void observe(Clock::duration delay, Clock::time_point now) noexcept;
+    inline bool overloaded() const noexcept { return _overloaded; }
+private:
+    AdmissionOptions _options;
+    // calls of every function running at once
+    std::vector<size_t> _running;
+    Clock::time_point _interval_end {};
+    Clock::duration _min_delay { Clock::duration::max() };
+    bool _overloaded { false };
+
+    inline void release(Message::MethodID method) noexcept { --_running[method]; }
+};
+
+TINYRPC_NS_END
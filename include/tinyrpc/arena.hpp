@@ -0,0 +1,154 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#ifdef TINYRPC_ENABLE_PROTOBUF
+#include <google/protobuf/arena.h>
+#else
+namespace google::protobuf { class Arena; }
+#endif
+
+#include "tinyrpc_export.hpp"
+#include "./concepts.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+#ifdef TINYRPC_ENABLE_PROTOBUF
+/// protobuf arenas of the calling thread, reset and reused across requests
+///
+/// every arena starts on a block of TINYRPC_ARENA_BLOCK_SIZE bytes that it
+/// keeps across resets, so a request whose messages fit in the block does
+/// not allocate at all. A lease goes back to the pool it came from, which
+/// must be on the same thread.
+class TINYRPC_EXPORT ArenaPool {
+    struct Entry;
+public:
+    class TINYRPC_EXPORT Lease {
+    public:
+        Lease() noexcept;
+        Lease(Lease&& lease) noexcept;
+        Lease& operator=(Lease&& lease) noexcept;
+        ~Lease() noexcept;
+
+        /// nullptr if empty
+        google::protobuf::Arena* get() const noexcept;
+    private:
+        friend class ArenaPool;
+        std::unique_ptr<Entry> _entry;
+
+        explicit Lease(std::unique_ptr<Entry>&& entry) noexcept;
+    };
+
+    /// pool of the calling thread, created on first use
+    static ArenaPool& local() noexcept;
+
+    ArenaPool(ArenaPool&) = delete;
+    ArenaPool& operator=(ArenaPool&) = delete;
+    ~ArenaPool() noexcept;
+
+    Lease acquire() noexcept;
+private:
+    std::vector<std::unique_ptr<Entry>> _free {};
+
+    ArenaPool() noexcept = default;
+    void release(std::unique_ptr<Entry>&& entry) noexcept;
+};
+#else
+/// protobuf is disabled, no function takes messages so no lease is taken
+class ArenaPool {
+public:
+    struct Lease {
+        inline google::protobuf::Arena* get() const noexcept { return nullptr; }
+    };
+};
+#endif
+
+TINYRPC_NS_END
+
+
+TINYRPC_NS_BEGIN(utils)
+
+/// the message of a parameter or result taken by value, pointer or reference
+template<typename T>
+using proto_message_t = std::remove_cv_t<std::remove_pointer_t<std::remove_cvref_t<T>>>;
+
+/// parameters taken by pointer or lvalue reference are parsed onto the
+/// arena of the request, messages by value are not
+template<typename T>
+concept ArenaMessage = (std::is_pointer_v<T> || std::is_lvalue_reference_v<T>)
+    && concepts::ProtoType<proto_message_t<T>>;
+
+/// f(msg, google::protobuf::Arena*), results may be built on the arena
+template<typename Raw>
+constexpr bool takes_arena = [] {
+    if constexpr (std::tuple_size_v<Raw> == 2) {
+        return std::is_same_v<std::tuple_element_t<1, Raw>, google::protobuf::Arena*>;
+    } else {
+        return false;
+    }
+}();
+
+/// if a request of a function with raw parameters Raw and result R needs an arena
+template<typename Raw, typename R>
+constexpr bool uses_arena = ArenaMessage<std::tuple_element_t<0, Raw>>
+    || takes_arena<Raw>
+    || (std::is_pointer_v<R> && concepts::ProtoType<proto_message_t<R>>);
+
+/// arena of one request, empty unless it is needed
+template<typename Raw, typename R>
+ArenaPool::Lease request_arena() noexcept {
+#ifdef TINYRPC_ENABLE_PROTOBUF
+    if constexpr (uses_arena<Raw, R>) {
+        return ArenaPool::local().acquire();
+    }
+#endif
+    return {};
+}
+
+/// the first argument of a function with raw parameters Raw parsed from
+/// body, a pointer to a message on arena or a message by value, nullopt
+/// if body does not parse
+template<typename Raw, typename Arena>
+auto parse_proto(std::string_view body, Arena* arena) {
+    using Param = std::tuple_element_t<0, Raw>;
+    using Msg = proto_message_t<Param>;
+    if constexpr (ArenaMessage<Param>) {
+        // a partial message stays on the arena until the request is done
+        auto msg = Arena::template Create<Msg>(arena);
+        return msg->ParseFromArray(body.data(), body.size()) ? std::optional(msg) : std::nullopt;
+    } else {
+        std::optional<Msg> msg(std::in_place);
+        if (!msg->ParseFromArray(body.data(), body.size())) {
+            msg.reset();
+        }
+        return msg;
+    }
+}
+
+/// call f with a message parsed by parse_proto, which must outlive the call
+template<typename Raw, typename F, typename Msg, typename Arena>
+decltype(auto) call_proto(F& f, Msg& msg, Arena* arena) {
+    using Param = std::tuple_element_t<0, Raw>;
+    auto&& arg = [&]() -> decltype(auto) {
+        if constexpr (std::is_pointer_v<Param>) {
+            return (msg);
+        } else if constexpr (ArenaMessage<Param>) {
+            return (*msg);
+        } else {
+            return std::move(msg);
+        }
+    }();
+    if constexpr (takes_arena<Raw>) {
+        return f(std::forward<decltype(arg)>(arg), arena);
+    } else {
+        return f(std::forward<decltype(arg)>(arg));
+    }
+}
+
+TINYRPC_NS_END
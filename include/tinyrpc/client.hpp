@@ -1,9 +1,20 @@
 #pragma once
+#include <chrono>
+#include <concepts>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+
 #include <asyncio.hpp>
+#include <growable_buffer.hpp>
 
 #include "tinyrpc_export.hpp"
 #include "../tinyrpc_ns.hpp"
+#include "./local.hpp"
 #include "./message.hpp"
+#include "./options.hpp"
+#include "./stream.hpp"
+#include "./unix_socket.hpp"
 
 
 TINYRPC_NS_BEGIN()
@@ -11,20 +22,108 @@ TINYRPC_NS_BEGIN()
 enum class RPCError {
     ConnectionClosed,
     FunctionNotFound,
+    Timeout,
+    /// the server shed the request without running it, retrying elsewhere
+    /// or later is safe
+    Overloaded,
+    /// the server could not decode the arguments, the function did not run
+    BadRequest,
+    /// the response did not decode as the expected result
+    DecodeError,
+    /// the request body did not fit in a frame and was not sent, or the
+    /// response body did not once the function ran
+    TooLarge,
+};
+
+/// writes the body of a request right behind its header in the write
+/// buffer of the connection, a borrowed reference to any callable taking a
+/// GrowableBuffer&, which only has to live until Client::call returns
+class BodyWriter {
+public:
+    template<typename F>
+    requires (!std::same_as<std::remove_cvref_t<F>, BodyWriter> && std::invocable<F&, GrowableBuffer&>)
+    BodyWriter(F&& f) noexcept:
+        _f((void*)&f),
+        _write([](void* f, GrowableBuffer& out) { (*(std::remove_reference_t<F>*)f)(out); }) {}
+
+    inline void operator()(GrowableBuffer& out) const { _write(_f, out); }
+private:
+    void* _f;
+    void (*_write)(void*, GrowableBuffer&);
 };
 
 class TINYRPC_EXPORT Client {
+    struct impl;
 public:
+    /// requests started while a batch is alive are handed to the writer
+    /// together once it is submitted or destroyed, so they leave in one flush
+    class TINYRPC_EXPORT Batch {
+    public:
+        Batch(Batch&) = delete;
+        Batch(Batch&&) noexcept;
+        Batch& operator=(Batch&) = delete;
+        Batch& operator=(Batch&&) = delete;
+        ~Batch() noexcept;
+        void submit() noexcept;
+    private:
+        friend class Client;
+        impl* _client;
+
+        explicit Batch(impl* client) noexcept;
+    };
+
     Client() noexcept;
     Client(Client&) = delete;
     Client(Client&&) noexcept;
     ~Client() noexcept;
     Client& operator=(Client&) = delete;
     Client& operator=(Client&&) noexcept;
+    /// applies to connections made afterwards
+    void set_options(const ConnectionOptions& options) noexcept;
+    /// a host of the form unix:PATH connects to a unix domain socket, see
+    /// UNIX_PREFIX
     asyncio::Task<bool> connect(const char* host, short port) noexcept;
-    asyncio::Task<Message, RPCError> call(std::string_view name, std::string_view data) noexcept;
+    /// connect to a server of the same process, calls then go straight to
+    /// its functions and are answered before call returns, so they neither
+    /// time out nor batch. Streaming calls are not available.
+    void connect(LocalEndpoint& server) noexcept;
+    /// with a non zero timeout the server drops the request once it expired
+    /// and the call fails with RPCError::Timeout, cancelling it on the
+    /// server if still running. The request is queued right away, the
+    /// caller then waits while the connection is congested.
+    asyncio::Task<Message, RPCError> call(
+        std::string_view name,
+        std::string_view data,
+        std::chrono::milliseconds timeout = {}
+    ) noexcept;
+    /// like above with the body serialized by write straight into the write
+    /// buffer, it is called before this returns
+    asyncio::Task<Message, RPCError> call(
+        std::string_view name,
+        BodyWriter write,
+        std::chrono::milliseconds timeout = {}
+    ) noexcept;
+    /// fetch the function table of the connected server, afterwards calls to
+    /// functions it knows are sent with a fixed width index instead of the name
+    asyncio::Task<bool> fetch_method_table() noexcept;
+    /// start a streaming call, nothing is sent before the first write or
+    /// finish, the first chunk holds the arguments of the call. finish()
+    /// the stream before dropping it, nullptr if not connected
+    std::shared_ptr<Stream> open_stream(std::string_view name) noexcept;
+    /// batches nest, the writer is woken once the outermost one is submitted
+    Batch batch() noexcept;
+    /// calls of function name with the same body as one still in flight send
+    /// no request of their own but share its response or error, each still
+    /// times out on its own. Should the call they wait for time out or be
+    /// cancelled one of them sends the request again. Only for functions
+    /// free of side effects.
+    void coalesce(std::string_view name) noexcept;
+    /// the function name of the server connected in process if it can be
+    /// called with the arguments and result of signature, nullptr otherwise
+    const DispatchTable::Entry* find_direct(std::string_view name, const std::type_info& signature) const noexcept;
+    /// call a function found by find_direct
+    asyncio::Task<> call_direct(const DispatchTable::Entry& method, DirectCall call) noexcept;
 private:
-    struct impl;
     impl* _pimpl;
 };
 
@@ -0,0 +1,443 @@
+#pragma once
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <msgpack.hpp>
+
+#include "../concepts.hpp"
+#include "../../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN(codec)
+
+/// pull parser over msgpack encoded bytes
+///
+/// values are read in place, strings and binaries can be viewed without a
+/// copy. A failed read leaves the position undefined, callers give up on the
+/// whole buffer then.
+class MsgpackReader {
+public:
+    explicit MsgpackReader(std::string_view data) noexcept: _data(data) {}
+
+    inline bool done() const noexcept { return _pos == _data.size(); }
+
+    /// consume a nil, false if the next value is something else
+    inline bool read_nil() noexcept {
+        if (_pos < _data.size() && byte(_pos) == 0xc0) {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+
+    inline bool read(bool& value) noexcept {
+        if (_pos < _data.size() && (byte(_pos) | 1) == 0xc3) {
+            value = byte(_pos++) == 0xc3;
+            return true;
+        }
+        return false;
+    }
+
+    /// fails if the number does not fit into T
+    template<std::integral T>
+    bool read(T& value) noexcept {
+        if (_pos >= _data.size()) {
+            return false;
+        }
+        auto b = byte(_pos);
+        if (b <= 0x7f) {
+            ++_pos;
+            return assign(value, b);
+        }
+        if (b >= 0xe0) {
+            ++_pos;
+            return assign(value, (int8_t)b);
+        }
+        ++_pos;
+        switch (b) {
+            case 0xcc: return read_as<uint8_t>(value);
+            case 0xcd: return read_as<uint16_t>(value);
+            case 0xce: return read_as<uint32_t>(value);
+            case 0xcf: return read_as<uint64_t>(value);
+            case 0xd0: return read_as<int8_t>(value);
+            case 0xd1: return read_as<int16_t>(value);
+            case 0xd2: return read_as<int32_t>(value);
+            case 0xd3: return read_as<int64_t>(value);
+            default: --_pos; return false;
+        }
+    }
+
+    /// integers are converted as well
+    template<std::floating_point T>
+    bool read(T& value) noexcept {
+        if (_pos >= _data.size()) {
+            return false;
+        }
+        auto b = byte(_pos);
+        if (b == 0xca || b == 0xcb) {
+            ++_pos;
+            if (b == 0xca) {
+                uint32_t bits;
+                if (!read_be(bits)) return false;
+                value = (T)std::bit_cast<float>(bits);
+            } else {
+                uint64_t bits;
+                if (!read_be(bits)) return false;
+                value = (T)std::bit_cast<double>(bits);
+            }
+            return true;
+        }
+        if (b <= 0x7f || b == 0xcc || b == 0xcd || b == 0xce || b == 0xcf) {
+            uint64_t n;
+            if (!read(n)) return false;
+            value = (T)n;
+            return true;
+        }
+        int64_t n;
+        if (!read(n)) return false;
+        value = (T)n;
+        return true;
+    }
+
+    /// a str or bin, viewing into the buffer
+    bool read_raw(std::string_view& value) noexcept {
+        if (_pos >= _data.size()) {
+            return false;
+        }
+        auto b = byte(_pos++);
+        uint32_t size;
+        if ((b & 0xe0) == 0xa0) {
+            size = b & 0x1f;
+        } else if (b == 0xd9 || b == 0xc4) {
+            uint8_t n;
+            if (!read_be(n)) return false;
+            size = n;
+        } else if (b == 0xda || b == 0xc5) {
+            uint16_t n;
+            if (!read_be(n)) return false;
+            size = n;
+        } else if (b == 0xdb || b == 0xc6) {
+            if (!read_be(size)) return false;
+        } else {
+            --_pos;
+            return false;
+        }
+        return take(size, value);
+    }
+
+    /// number of elements that follow
+    bool read_array(uint32_t& size) noexcept {
+        return read_container(size, 0x90, 0xdc);
+    }
+
+    /// number of key value pairs that follow
+    bool read_map(uint32_t& size) noexcept {
+        return read_container(size, 0x80, 0xde);
+    }
+
+    /// step over the next value with everything nested in it, value views
+    /// its encoding
+    bool skip(std::string_view& value) noexcept {
+        auto start = _pos;
+        // values left to step over, containers add their elements
+        uint64_t left = 1;
+        while (left > 0) {
+            --left;
+            if (_pos >= _data.size()) {
+                return false;
+            }
+            auto b = byte(_pos);
+            uint32_t size = 0;
+            std::string_view ignored;
+            if (b <= 0x7f || b >= 0xe0 || b == 0xc0 || b == 0xc2 || b == 0xc3) {
+                ++_pos;
+            } else if ((b & 0xf0) == 0x90 || b == 0xdc || b == 0xdd) {
+                if (!read_array(size)) return false;
+                left += size;
+            } else if ((b & 0xf0) == 0x80 || b == 0xde || b == 0xdf) {
+                if (!read_map(size)) return false;
+                left += (uint64_t)size*2;
+            } else if (read_raw(ignored)) {
+                // str or bin
+            } else {
+                ++_pos;
+                switch (b) {
+                    case 0xcc: case 0xd0: size = 1; break;
+                    case 0xcd: case 0xd1: size = 2; break;
+                    case 0xca: case 0xce: case 0xd2: size = 4; break;
+                    case 0xcb: case 0xcf: case 0xd3: size = 8; break;
+                    // fixext, type byte and data
+                    case 0xd4: size = 2; break;
+                    case 0xd5: size = 3; break;
+                    case 0xd6: size = 5; break;
+                    case 0xd7: size = 9; break;
+                    case 0xd8: size = 17; break;
+                    case 0xc7: case 0xc8: case 0xc9: {
+                        if (b == 0xc7) {
+                            uint8_t n;
+                            if (!read_be(n)) return false;
+                            size = n;
+                        } else if (b == 0xc8) {
+                            uint16_t n;
+                            if (!read_be(n)) return false;
+                            size = n;
+                        } else if (!read_be(size)) {
+                            return false;
+                        }
+                        // the type byte
+                        ++size;
+                        break;
+                    }
+                    default: return false;
+                }
+                if (!take(size, ignored)) return false;
+            }
+        }
+        value = _data.substr(start, _pos-start);
+        return true;
+    }
+private:
+    std::string_view _data;
+    size_t _pos { 0 };
+
+    inline uint8_t byte(size_t pos) const noexcept {
+        return (uint8_t)_data[pos];
+    }
+
+    inline bool take(size_t size, std::string_view& value) noexcept {
+        if (_data.size()-_pos < size) {
+            return false;
+        }
+        value = _data.substr(_pos, size);
+        _pos += size;
+        return true;
+    }
+
+    template<typename U>
+    inline bool read_be(U& value) noexcept {
+        std::string_view bytes;
+        if (!take(sizeof(U), bytes)) {
+            return false;
+        }
+        std::make_unsigned_t<U> n;
+        std::memcpy(&n, bytes.data(), sizeof(U));
+        if constexpr (std::endian::native == std::endian::little && sizeof(U) > 1) {
+            n = std::byteswap(n);
+        }
+        value = (U)n;
+        return true;
+    }
+
+    template<typename U, typename T>
+    inline bool read_as(T& value) noexcept {
+        U n;
+        return read_be(n) && assign(value, n);
+    }
+
+    template<typename T, typename U>
+    static inline bool assign(T& value, U n) noexcept {
+        // std::in_range leaves out character types
+        if constexpr (std::is_signed_v<U>) {
+            if (n < 0 ? (!std::is_signed_v<T> || (int64_t)n < (int64_t)std::numeric_limits<T>::min())
+                      : (uint64_t)n > (uint64_t)std::numeric_limits<T>::max()) {
+                return false;
+            }
+        } else if ((uint64_t)n > (uint64_t)std::numeric_limits<T>::max()) {
+            return false;
+        }
+        value = (T)n;
+        return true;
+    }
+
+    bool read_container(uint32_t& size, uint8_t fix, uint8_t first) noexcept {
+        if (_pos >= _data.size()) {
+            return false;
+        }
+        auto b = byte(_pos);
+        if ((b & 0xf0) == fix) {
+            ++_pos;
+            size = b & 0x0f;
+            return true;
+        }
+        ++_pos;
+        if (b == first) {
+            uint16_t n;
+            if (!read_be(n)) return false;
+            size = n;
+            return true;
+        }
+        if (b == first+1) {
+            return read_be(size);
+        }
+        --_pos;
+        return false;
+    }
+};
+
+
+template<typename T>
+struct is_optional: std::false_type {};
+
+template<typename T>
+struct is_optional<std::optional<T>>: std::true_type {};
+
+/// views into the decoded buffer, only valid as long as it is
+template<typename T>
+concept Borrowed = std::same_as<T, std::string_view>
+    || std::same_as<T, std::span<const char>>
+    || std::same_as<T, std::span<const unsigned char>>
+    || std::same_as<T, std::span<const std::byte>>;
+
+template<typename T>
+concept ByteSequence = requires(T t, const char* p) {
+    t.assign(p, p);
+    requires sizeof(typename T::value_type) == 1;
+    requires std::is_integral_v<typename T::value_type> || std::same_as<typename T::value_type, std::byte>;
+};
+
+template<typename T>
+concept MapLike = requires(T t) {
+    typename T::key_type;
+    typename T::mapped_type;
+    t.emplace(std::declval<typename T::key_type>(), std::declval<typename T::mapped_type>());
+};
+
+template<typename T>
+concept SequenceLike = requires(T t) {
+    typename T::value_type;
+    t.insert(t.end(), std::declval<typename T::value_type>());
+};
+
+template<typename T>
+bool read(MsgpackReader& reader, T& value);
+
+template<typename Tuple, size_t... I>
+inline bool read_elements(MsgpackReader& reader, Tuple& value, std::index_sequence<I...>) {
+    return (read(reader, std::get<I>(value)) && ...);
+}
+
+/// read the next value straight into value, types msgpack-c packs are
+/// understood, others go through a msgpack::object of their own
+template<typename T>
+bool read(MsgpackReader& reader, T& value) {
+    if constexpr (std::same_as<T, bool> || std::integral<T> || std::floating_point<T>) {
+        return reader.read(value);
+    } else if constexpr (Borrowed<T>) {
+        std::string_view raw;
+        if (!reader.read_raw(raw)) {
+            return false;
+        }
+        value = T((const typename T::value_type*)raw.data(), raw.size());
+        return true;
+    } else if constexpr (ByteSequence<T>) {
+        std::string_view raw;
+        if (reader.read_raw(raw)) {
+            value.assign((const typename T::value_type*)raw.data(), (const typename T::value_type*)raw.data()+raw.size());
+            return true;
+        }
+        if constexpr (SequenceLike<T>) {
+            // a vector<char> may come as an array of numbers as well
+            uint32_t size;
+            if (!reader.read_array(size)) {
+                return false;
+            }
+            value.clear();
+            for (uint32_t i = 0; i < size; ++i) {
+                typename T::value_type element;
+                if (!read(reader, element)) {
+                    return false;
+                }
+                value.insert(value.end(), std::move(element));
+            }
+            return true;
+        } else {
+            return false;
+        }
+    } else if constexpr (is_optional<T>::value) {
+        if (reader.read_nil()) {
+            value.reset();
+            return true;
+        }
+        return read(reader, value.emplace());
+    } else if constexpr (concepts::TupleLike<T>) {
+        uint32_t size;
+        if (!reader.read_array(size) || size < std::tuple_size_v<T>) {
+            return false;
+        }
+        if (!read_elements(reader, value, std::make_index_sequence<std::tuple_size_v<T>>())) {
+            return false;
+        }
+        // elements added by a newer caller are ignored
+        std::string_view ignored;
+        for (auto i = std::tuple_size_v<T>; i < size; ++i) {
+            if (!reader.skip(ignored)) {
+                return false;
+            }
+        }
+        return true;
+    } else if constexpr (MapLike<T>) {
+        uint32_t size;
+        if (!reader.read_map(size)) {
+            return false;
+        }
+        value.clear();
+        for (uint32_t i = 0; i < size; ++i) {
+            std::remove_const_t<typename T::key_type> key;
+            typename T::mapped_type mapped;
+            if (!read(reader, key) || !read(reader, mapped)) {
+                return false;
+            }
+            value.emplace(std::move(key), std::move(mapped));
+        }
+        return true;
+    } else if constexpr (SequenceLike<T>) {
+        uint32_t size;
+        if (!reader.read_array(size)) {
+            return false;
+        }
+        value.clear();
+        for (uint32_t i = 0; i < size; ++i) {
+            typename T::value_type element;
+            if (!read(reader, element)) {
+                return false;
+            }
+            value.insert(value.end(), std::move(element));
+        }
+        return true;
+    } else {
+        std::string_view raw;
+        if (!reader.skip(raw)) {
+            return false;
+        }
+        // msgpack::type_error on a mismatch, which is just another value
+        // that does not decode here
+        try {
+            msgpack::unpack(raw.data(), raw.size()).get().convert(value);
+        } catch (const std::exception&) {
+            return false;
+        }
+        return true;
+    }
+}
+
+/// decode the value at the start of data into value, false if data does
+/// not hold one of its type
+template<typename T>
+inline bool decode(std::string_view data, T& value) {
+    MsgpackReader reader(data);
+    return read(reader, value);
+}
+
+TINYRPC_NS_END
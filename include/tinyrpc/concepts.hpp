@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include <concepts>
+#include <tuple>
+#include <type_traits>
 
 #include "../tinyrpc_ns.hpp"
 
@@ -17,4 +19,9 @@ concept ProtoType = requires(T t) {
     };
 };
 
+template<typename T>
+concept TupleLike = requires {
+    std::tuple_size<std::remove_cvref_t<T>>::value;
+};
+
 TINYRPC_NS_END
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <map>
+#include <optional>
+
+#include <asyncio.hpp>
+
+#include "tinyrpc_export.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// deadlines of one event loop multiplexed on a single timerfd armed to
+/// the earliest of them, so scheduling is a tree insert and a syscall at
+/// most
+class TINYRPC_EXPORT DeadlineTimer {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::move_only_function<void()>;
+    using Token = std::pair<Clock::time_point, uint64_t>;
+
+    DeadlineTimer() noexcept = default;
+    DeadlineTimer(DeadlineTimer&) = delete;
+    DeadlineTimer& operator=(DeadlineTimer&) = delete;
+    ~DeadlineTimer() noexcept;
+
+    /// run callback on the calling thread's event loop once deadline passed
+    Token schedule(Clock::time_point deadline, Callback&& callback) noexcept;
+    /// drop a callback that has not run yet
+    void cancel(const Token& token) noexcept;
+private:
+    std::map<Token, Callback> _callbacks {};
+    uint64_t _seq { 0 };
+    int _fd { -1 };
+    std::optional<asyncio::Task<>> _task { std::nullopt };
+
+    void arm() noexcept;
+    asyncio::Task<> fire_forever() noexcept;
+};
+
+TINYRPC_NS_END
@@ -0,0 +1,74 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "tinyrpc_export.hpp"
+#include "./handler.hpp"
+#include "./message.hpp"
+#include "./response_cache.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// function name to handler map of a server
+///
+/// entries are dense and indexed by method id in registration order, names
+/// resolve through an open addressing table probed with string_view so that
+/// dispatching by name neither allocates nor hashes more than once. The
+/// table is frozen once the server runs and read-only afterwards.
+class TINYRPC_EXPORT DispatchTable {
+public:
+    struct Entry {
+        std::string name;
+        Handler handler;
+        Execution execution { Execution::Inline };
+        Message::MethodID id { Message::invalid_method };
+        CachePolicy cache {};
+        /// calls running at once per event loop, 0 for no limit
+        size_t max_running { 0 };
+    };
+
+    DispatchTable() noexcept = default;
+    DispatchTable(DispatchTable&) = delete;
+    DispatchTable(DispatchTable&&) noexcept = default;
+    DispatchTable& operator=(DispatchTable&) = delete;
+    DispatchTable& operator=(DispatchTable&&) noexcept = default;
+
+    /// add or replace the handler of name, false if the table is frozen
+    bool add(
+        std::string_view name,
+        Handler&& handler,
+        Execution execution = Execution::Inline,
+        CachePolicy cache = {}
+    ) noexcept;
+    /// limit the calls of name running at once, false if the table is
+    /// frozen or name not found
+    bool limit(std::string_view name, size_t max_running) noexcept;
+    inline void freeze() noexcept { _frozen = true; }
+    inline bool frozen() const noexcept { return _frozen; }
+
+    const Entry* find(std::string_view name) const noexcept;
+    inline const Entry* find(Message::MethodID id) const noexcept {
+        return id < _entries.size() ? &_entries[id] : nullptr;
+    }
+    inline const std::deque<Entry>& entries() const noexcept { return _entries; }
+private:
+    struct Slot {
+        size_t hash;
+        Message::MethodID id { Message::invalid_method };
+    };
+
+    // stays in place while async handlers run
+    std::deque<Entry> _entries {};
+    // power of two sized, at most half full
+    std::vector<Slot> _slots {};
+    bool _frozen { false };
+
+    size_t probe(std::string_view name, size_t hash) const noexcept;
+    void rehash(size_t capacity) noexcept;
+};
+
+TINYRPC_NS_END
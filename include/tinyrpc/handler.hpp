@@ -0,0 +1,262 @@
+#pragma once
+#include <concepts>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include <asyncio.hpp>
+#include <growable_buffer.hpp>
+
+#include "./message.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// where a sync handler runs
+enum class Execution {
+    /// on the event loop of the connection
+    Inline,
+    /// on the worker thread pool of the server, for blocking or cpu heavy
+    /// handlers, the response is written back on the connection's loop
+    WorkerPool,
+};
+
+class Stream;
+
+/// arguments and result of an in-process call, passed without encoding
+///
+/// args points to the decayed argument tuple, which the function may move
+/// from, result to a default constructed result or is nullptr if it is void
+struct DirectCall {
+    void* args;
+    void* result;
+};
+
+/// identifies the decayed argument tuple and the result of a function, a
+/// direct call is only made if the caller's are the same
+template<typename Args, typename R>
+struct Signature {};
+
+/// type erased function handler, either sync, async or streaming
+///
+/// callables up to inline_size bytes are stored in place, so calling one
+/// costs a single indirect call. Sync and async callables may return
+/// whether the request decoded, having written nothing if not, the server
+/// then answers with a bad request status.
+class Handler {
+public:
+    static constexpr size_t inline_size = 6*sizeof(void*);
+
+    Handler() noexcept = default;
+    Handler(Handler&) = delete;
+    inline Handler(Handler&& h) noexcept:
+        _vtable(std::exchange(h._vtable, nullptr)),
+        _signature(std::exchange(h._signature, nullptr))
+    {
+        if (_vtable) _vtable->move(_storage, h._storage);
+    }
+    inline ~Handler() noexcept { reset(); }
+    Handler& operator=(Handler&) = delete;
+    inline Handler& operator=(Handler&& h) noexcept {
+        if (this != &h) {
+            reset();
+            _vtable = std::exchange(h._vtable, nullptr);
+            _signature = std::exchange(h._signature, nullptr);
+            if (_vtable) _vtable->move(_storage, h._storage);
+        }
+        return *this;
+    }
+
+    /// f: void(Message&&, GrowableBuffer&) or bool(Message&&, GrowableBuffer&)
+    template<typename F>
+    static Handler sync(F&& f) noexcept {
+        Handler h;
+        h.emplace<std::decay_t<F>, Kind::Sync>(std::forward<F>(f));
+        return h;
+    }
+
+    /// f: void(Message&&, GrowableBuffer&) and void(DirectCall), the latter
+    /// called by in-process clients whose Signature is signature
+    template<typename F>
+    static Handler sync(F&& f, const std::type_info& signature) noexcept {
+        auto h = sync(std::forward<F>(f));
+        h._signature = &signature;
+        return h;
+    }
+
+    /// f: Task<>(Message&&, GrowableBuffer&) or Task<bool>(Message&&, GrowableBuffer&)
+    template<typename F>
+    static Handler async(F&& f) noexcept {
+        Handler h;
+        h.emplace<std::decay_t<F>, Kind::Async>(std::forward<F>(f));
+        return h;
+    }
+
+    /// f: Task<bool>(Message&&, GrowableBuffer&) and Task<>(DirectCall)
+    template<typename F>
+    static Handler async(F&& f, const std::type_info& signature) noexcept {
+        auto h = async(std::forward<F>(f));
+        h._signature = &signature;
+        return h;
+    }
+
+    /// f: Task<>(Stream&), the first chunk holds the arguments of the call
+    template<typename F>
+    static Handler stream(F&& f) noexcept {
+        Handler h;
+        h.emplace<std::decay_t<F>, Kind::Stream>(std::forward<F>(f));
+        return h;
+    }
+
+    inline explicit operator bool() const noexcept { return _vtable; }
+    inline bool is_async() const noexcept { return _vtable->kind == Kind::Async; }
+    inline bool is_stream() const noexcept { return _vtable->kind == Kind::Stream; }
+    /// true if the function takes arguments and returns a result of signature
+    inline bool direct(const std::type_info& signature) const noexcept {
+        return _signature && *_signature == signature;
+    }
+
+    /// false if the request did not decode
+    inline bool operator()(Message&& msg, GrowableBuffer& out) const noexcept {
+        return _vtable->call((void*)_storage, std::move(msg), out);
+    }
+
+    inline ASYNCIO_NS::Task<bool> call_async(Message&& msg, GrowableBuffer& out) const noexcept {
+        return _vtable->call_async((void*)_storage, std::move(msg), out);
+    }
+
+    inline ASYNCIO_NS::Task<> call_stream(Stream& stream) const noexcept {
+        return _vtable->call_stream((void*)_storage, stream);
+    }
+
+    /// only if direct() is true
+    inline void call_direct(DirectCall call) const noexcept {
+        _vtable->call_direct((void*)_storage, call);
+    }
+
+    inline ASYNCIO_NS::Task<> call_direct_async(DirectCall call) const noexcept {
+        return _vtable->call_direct_async((void*)_storage, call);
+    }
+private:
+    enum class Kind {
+        Sync,
+        Async,
+        Stream,
+    };
+
+    struct VTable {
+        Kind kind;
+        bool (*call)(void*, Message&&, GrowableBuffer&);
+        ASYNCIO_NS::Task<bool> (*call_async)(void*, Message&&, GrowableBuffer&);
+        ASYNCIO_NS::Task<> (*call_stream)(void*, Stream&);
+        void (*call_direct)(void*, DirectCall);
+        ASYNCIO_NS::Task<> (*call_direct_async)(void*, DirectCall);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    /// a handler that cannot tell, its requests count as decoded
+    static ASYNCIO_NS::Task<bool> decoded(ASYNCIO_NS::Task<> task) noexcept {
+        co_await std::move(task);
+        co_return true;
+    }
+
+    template<typename F>
+    static constexpr bool stored_inline = sizeof(F) <= inline_size
+        && alignof(F) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<F>;
+
+    template<typename F>
+    static F& get(void* storage) noexcept {
+        if constexpr (stored_inline<F>) {
+            return *std::launder((F*)storage);
+        } else {
+            return **std::launder((F**)storage);
+        }
+    }
+
+    template<typename F, Kind K>
+    static constexpr VTable vtable {
+        .kind = K,
+        .call = [](void* s, Message&& msg, GrowableBuffer& out) -> bool {
+            if constexpr (K == Kind::Sync) {
+                if constexpr (std::same_as<std::invoke_result_t<F&, Message&&, GrowableBuffer&>, bool>) {
+                    return get<F>(s)(std::move(msg), out);
+                } else {
+                    get<F>(s)(std::move(msg), out);
+                }
+            }
+            return true;
+        },
+        .call_async = [](void* s, Message&& msg, GrowableBuffer& out) -> ASYNCIO_NS::Task<bool> {
+            if constexpr (K == Kind::Async) {
+                if constexpr (std::same_as<std::invoke_result_t<F&, Message&&, GrowableBuffer&>, ASYNCIO_NS::Task<bool>>) {
+                    return get<F>(s)(std::move(msg), out);
+                } else {
+                    return decoded(get<F>(s)(std::move(msg), out));
+                }
+            } else {
+                return {};
+            }
+        },
+        .call_stream = [](void* s, Stream& stream) -> ASYNCIO_NS::Task<> {
+            if constexpr (K == Kind::Stream) {
+                return get<F>(s)(stream);
+            } else {
+                return {};
+            }
+        },
+        .call_direct = [](void* s, DirectCall call) {
+            if constexpr (K == Kind::Sync && std::invocable<F&, DirectCall>) get<F>(s)(call);
+        },
+        .call_direct_async = [](void* s, DirectCall call) -> ASYNCIO_NS::Task<> {
+            if constexpr (K == Kind::Async && std::invocable<F&, DirectCall>) {
+                return get<F>(s)(call);
+            } else {
+                return {};
+            }
+        },
+        .move = [](void* dst, void* src) noexcept {
+            if constexpr (stored_inline<F>) {
+                new (dst) F(std::move(get<F>(src)));
+                get<F>(src).~F();
+            } else {
+                *(F**)dst = *(F**)src;
+            }
+        },
+        .destroy = [](void* s) noexcept {
+            if constexpr (stored_inline<F>) {
+                get<F>(s).~F();
+            } else {
+                delete &get<F>(s);
+            }
+        },
+    };
+
+    template<typename F, Kind K, typename Arg>
+    void emplace(Arg&& f) noexcept {
+        if constexpr (stored_inline<F>) {
+            new (_storage) F(std::forward<Arg>(f));
+        } else {
+            *(F**)_storage = new F(std::forward<Arg>(f));
+        }
+        _vtable = &vtable<F, K>;
+    }
+
+    inline void reset() noexcept {
+        _signature = nullptr;
+        if (auto vt = std::exchange(_vtable, nullptr); vt) {
+            vt->destroy(_storage);
+        }
+    }
+
+    alignas(std::max_align_t) std::byte _storage[inline_size];
+    const VTable* _vtable { nullptr };
+    // set if the function can be called directly
+    const std::type_info* _signature { nullptr };
+};
+
+TINYRPC_NS_END
@@ -0,0 +1,48 @@
+#pragma once
+#include <string_view>
+#include <typeinfo>
+
+#include <asyncio.hpp>
+#include <growable_buffer.hpp>
+
+#include "./dispatch_table.hpp"
+#include "./handler.hpp"
+#include "./message.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+class MetricsShard;
+
+/// outcome of LocalEndpoint::call
+enum class LocalStatus {
+    Ok,
+    NotFound,
+    /// the arguments did not decode, nothing was written to out
+    BadRequest,
+};
+
+/// the side of a server that clients of the same process call into, see
+/// Server::local() and Client::connect(LocalEndpoint&)
+///
+/// calls skip sockets and framing and run on the event loop of the caller,
+/// Execution::WorkerPool functions on the worker pool of the server. Only
+/// direct calls skip encoding as well, call() still takes an encoded
+/// request and writes the encoded response. Being virtual, clients reach
+/// the server without linking against it.
+class LocalEndpoint {
+public:
+    /// counters for the calls made from the calling thread
+    virtual MetricsShard& local_shard() noexcept = 0;
+    /// answer request like a connection would, with the response body
+    /// written to out
+    virtual asyncio::Task<LocalStatus> call(Message&& request, GrowableBuffer& out, MetricsShard& shard) noexcept = 0;
+    /// the function name if it can be called directly with signature
+    virtual const DispatchTable::Entry* find_direct(std::string_view name, const std::type_info& signature) const noexcept = 0;
+    virtual asyncio::Task<> call_direct(const DispatchTable::Entry& method, DirectCall call, MetricsShard& shard) noexcept = 0;
+protected:
+    ~LocalEndpoint() noexcept = default;
+};
+
+TINYRPC_NS_END
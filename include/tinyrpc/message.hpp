@@ -1,37 +1,219 @@
 #pragma once
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <span>
 #include <string>
+#include <string_view>
 
 #include "tinyrpc_config.hpp"
 #include "../tinyrpc_ns.hpp"
+#include "./message/slab.hpp"
+#include "./message/v2.hpp"
 
 
 TINYRPC_NS_BEGIN()
 
+/// marks frames addressing the function by index instead of by name, it
+/// differs from VERIFY_FLAG in the second byte only
+constexpr inline int16_t INDEXED_VERIFY_FLAG = VERIFY_FLAG ^ (std::endian::native == std::endian::little ? 0x0700 : 0x0007);
+/// toggled in the flag of requests carrying a deadline, it leaves the first
+/// byte alone as well
+constexpr inline int16_t DEADLINE_FLAG_BIT = std::endian::native == std::endian::little ? 0x1000 : 0x0010;
+/// toggled in the flag of frames carrying one chunk of a stream, an empty
+/// chunk ends the stream of its sender
+constexpr inline int16_t STREAM_FLAG_BIT = std::endian::native == std::endian::little ? 0x2000 : 0x0020;
+/// bits toggled in either flag, frames are told apart by the rest
+constexpr inline int16_t FLAG_MODIFIER_BITS = DEADLINE_FLAG_BIT | STREAM_FLAG_BIT;
+static_assert([] {
+    auto second = [](int16_t flag) {
+        return (uint8_t)(std::endian::native == std::endian::little ? flag >> 8 : flag);
+    };
+    for (auto modifiers : { 0, (int)DEADLINE_FLAG_BIT, (int)STREAM_FLAG_BIT, (int)FLAG_MODIFIER_BITS }) {
+        if (second(VERIFY_FLAG ^ modifiers) == message::v2::VERSION
+            || second(INDEXED_VERIFY_FLAG ^ modifiers) == message::v2::VERSION) {
+            return false;
+        }
+    }
+    return true;
+}(), "version 2 frames are told apart by their second byte, which no version 1 flag may have");
+/// highest frame version spoken, see message::v2
+constexpr inline uint8_t FRAME_VERSION = message::v2::VERSION;
+/// reserved function returning the NUL separated function names of a
+/// server, a function's index is its position in that list
+constexpr inline std::string_view METHOD_TABLE_FUNC = "__methods";
+/// reserved function telling the server that the caller gave up on the
+/// request whose id is the body, it gets no response
+constexpr inline std::string_view CANCEL_FUNC = "__cancel";
+/// reserved function returning the ServerStats of a server
+constexpr inline std::string_view STATS_FUNC = "__stats";
+/// reserved name echoed by responses to version 1 calls by name that the
+/// server shed, see AdmissionControl
+constexpr inline std::string_view OVERLOADED_NAME = "__overloaded";
+/// reserved name echoed by responses to version 1 calls by name whose
+/// arguments did not decode
+constexpr inline std::string_view BAD_REQUEST_NAME = "__bad_request";
+/// reserved function taking the highest frame version of the caller as a
+/// single byte and answering the one both ends speak, callers send version
+/// 1 frames until it answered
+constexpr inline std::string_view PROTOCOL_FUNC = "__protocol";
+
+/// a parsed frame, viewing into the receive slab it was read into
+///
+/// version 1 frames come in two layouts, with native byte order:
+///     VERIFY_FLAG         | id | name\0        | body size | body
+///     INDEXED_VERIFY_FLAG | id | uint32 index | body size | body
+/// with DEADLINE_FLAG_BIT toggled in the flag a uint32 timeout follows the
+/// id, with STREAM_FLAG_BIT the body is a chunk of a stream. A response
+/// echoes the request header, an empty name or an index of invalid_method
+/// means the function was not found, OVERLOADED_NAME or an index of
+/// overloaded_method that it was shed, BAD_REQUEST_NAME or an index of
+/// bad_request_method that its arguments did not decode. Version 2 frames
+/// have a fixed size header instead, see message::v2, the accessors cover
+/// both.
 class Message {
 public:
     using ID = uint64_t;
+    using MethodID = uint32_t;
+    using Timeout = uint32_t;
+
+    static constexpr size_t name_pos = sizeof(VERIFY_FLAG)+sizeof(ID);
+    static constexpr MethodID invalid_method = -1;
+    static constexpr MethodID overloaded_method = invalid_method-1;
+    static constexpr MethodID bad_request_method = invalid_method-2;
 
     Message() noexcept = default;
     Message(Message&&) noexcept = default;
-    Message& operator=(Message&& msg) noexcept;
-    bool fill_id(char c) noexcept;
-    bool fill_func_name(char c) noexcept;
-    bool fill_body_size(char c) noexcept;
-    bool fill_body(char c) noexcept;
-
-    inline auto id() const noexcept { return *(ID*)(_data.data()+_id_pos); }
-    inline std::string_view func_name() const noexcept { return (const char*)(_data.data()+_name_pos); }
-    inline auto& body_size() const noexcept { return *(size_t*)(_data.data()+_size_pos); }
-    inline auto body() const noexcept { return std::string_view(_data.begin()+_body_pos, _data.end()); }
-    inline auto header() const noexcept { return std::string_view(_data.data(), _body_pos); }
-    inline const std::string& to_string() const & noexcept { return _data; }
-    inline std::string to_string() && noexcept { return std::move(_data); }
+    Message& operator=(Message&& msg) noexcept = default;
+    /// frame: whole frame starting at VERIFY_FLAG, size_pos: offset of the body
+    /// size field of version 1 frames, body_pos: offset of the body (equal to
+    /// size_pos if no body)
+    inline Message(message::Slab::Ref slab, std::string_view frame, size_t size_pos, size_t body_pos) noexcept:
+        _slab(std::move(slab)), _frame(frame), _size_pos(size_pos), _body_pos(body_pos) {}
+
+    static inline bool indexed(int16_t flag) noexcept {
+        return (flag | FLAG_MODIFIER_BITS) == (INDEXED_VERIFY_FLAG | FLAG_MODIFIER_BITS);
+    }
+    static inline bool has_deadline(int16_t flag) noexcept {
+        return (flag ^ VERIFY_FLAG) & DEADLINE_FLAG_BIT;
+    }
+    static inline bool stream(int16_t flag) noexcept {
+        return (flag ^ VERIFY_FLAG) & STREAM_FLAG_BIT;
+    }
+    /// offset of the function name or index in version 1 frames
+    static inline size_t method_pos(int16_t flag) noexcept {
+        return has_deadline(flag) ? name_pos+sizeof(Timeout) : name_pos;
+    }
+
+    /// largest body a frame with header carries
+    static inline size_t max_body_size(std::string_view header) noexcept {
+        return message::v2::is_v2(header) ? std::numeric_limits<uint32_t>::max() : std::numeric_limits<size_t>::max();
+    }
+    /// header: a whole header as written, including the body size field,
+    /// false and left as is if body_size exceeds max_body_size()
+    static inline bool set_body_size(std::span<char> header, size_t body_size) noexcept {
+        if (message::v2::is_v2({ header.data(), header.size() })) {
+            if (body_size > std::numeric_limits<uint32_t>::max()) {
+                return false;
+            }
+            message::v2::store<uint32_t>(header.data()+message::v2::BODY_SIZE_POS, body_size);
+        } else {
+            std::copy((char*)&body_size, (char*)&body_size+sizeof(size_t), header.data()+header.size()-sizeof(size_t));
+        }
+        return true;
+    }
+    static inline ID id(std::string_view header) noexcept {
+        if (message::v2::is_v2(header)) {
+            return message::v2::load<ID>(header.data()+message::v2::ID_POS);
+        }
+        return *(ID*)(header.data()+sizeof(VERIFY_FLAG));
+    }
+    /// mark header as one of a stream chunk
+    static inline void set_stream(std::span<char> header) noexcept {
+        if (message::v2::is_v2({ header.data(), header.size() })) {
+            header[message::v2::FLAGS_POS] |= message::v2::STREAM;
+        } else if (auto flag = *(int16_t*)header.data(); !stream(flag)) {
+            flag ^= STREAM_FLAG_BIT;
+            std::copy((char*)&flag, (char*)&flag+sizeof(flag), header.data());
+        }
+    }
+
+    inline bool v2() const noexcept { return message::v2::is_v2(_frame); }
+    /// version 1 only
+    inline int16_t flag() const noexcept { return *(int16_t*)_frame.data(); }
+    inline bool indexed() const noexcept {
+        return v2() ? message::v2::flags(_frame) & message::v2::INDEXED : indexed(flag());
+    }
+    inline bool has_deadline() const noexcept {
+        return v2() ? message::v2::flags(_frame) & message::v2::DEADLINE : has_deadline(flag());
+    }
+    inline bool stream() const noexcept {
+        return v2() ? message::v2::flags(_frame) & message::v2::STREAM : stream(flag());
+    }
+    inline size_t method_pos() const noexcept {
+        return v2() ? message::v2::method_pos(message::v2::flags(_frame)) : method_pos(flag());
+    }
+    inline ID id() const noexcept { return id(_frame); }
+    /// milliseconds the caller waits for the response from when the frame
+    /// arrived, 0 if it waits forever
+    inline Timeout timeout() const noexcept {
+        if (!has_deadline()) {
+            return 0;
+        }
+        if (v2()) {
+            return message::v2::load<Timeout>(_frame.data()+message::v2::HEADER_SIZE);
+        }
+        return *(Timeout*)(_frame.data()+name_pos);
+    }
+    inline MethodID method_id() const noexcept {
+        if (v2()) {
+            return message::v2::load<MethodID>(_frame.data()+method_pos());
+        }
+        return *(MethodID*)(_frame.data()+method_pos());
+    }
+    inline std::string_view func_name() const noexcept {
+        if (indexed()) {
+            return {};
+        }
+        auto pos = method_pos();
+        if (v2()) {
+            return _frame.substr(pos, (uint8_t)_frame[message::v2::NAME_SIZE_POS]);
+        }
+        return _frame.substr(pos, _size_pos-pos-1);
+    }
+    inline bool overloaded() const noexcept {
+        if (v2()) {
+            return message::v2::flags(_frame) & message::v2::OVERLOADED;
+        }
+        return indexed() ? method_id() == overloaded_method : func_name() == OVERLOADED_NAME;
+    }
+    inline bool bad_request() const noexcept {
+        if (v2()) {
+            return message::v2::flags(_frame) & message::v2::BAD_REQUEST;
+        }
+        return indexed() ? method_id() == bad_request_method : func_name() == BAD_REQUEST_NAME;
+    }
+    /// version 2 only, version 1 frames carry any body
+    inline bool too_large() const noexcept {
+        return v2() && message::v2::flags(_frame) & message::v2::TOO_LARGE;
+    }
+    inline bool func_not_found() const noexcept {
+        if (v2()) {
+            return message::v2::flags(_frame) & message::v2::NOT_FOUND;
+        }
+        return indexed() ? method_id() == invalid_method : _size_pos == method_pos()+1;
+    }
+    inline size_t body_size() const noexcept { return _frame.size()-_body_pos; }
+    inline auto body() const noexcept { return _frame.substr(_body_pos); }
+    inline auto header() const noexcept { return _frame.substr(0, _body_pos); }
+    /// another view of the same frame, keeping the slab alive as well
+    inline Message share() const noexcept { return Message(_slab, _frame, _size_pos, _body_pos); }
+    inline std::string to_string() const noexcept { return std::string(_frame); }
 private:
-    const int _id_pos { sizeof(VERIFY_FLAG) };
-    int _name_pos { -1 };
-    int _size_pos { -1 };
-    int _body_pos { -1 };
-    std::string _data { (char*)&VERIFY_FLAG, sizeof(VERIFY_FLAG) };
+    message::Slab::Ref _slab {};
+    std::string_view _frame {};
+    size_t _size_pos { 0 };
+    size_t _body_pos { 0 };
 };
 
 TINYRPC_NS_END
@@ -1,4 +1,7 @@
 #pragma once
+#include <span>
+#include <vector>
+
 #include <asyncio.hpp>
 
 #include "tinyrpc_export.hpp"
@@ -8,6 +11,15 @@
 
 TINYRPC_NS_BEGIN(message)
 
+/// frame parser reading into refcounted slabs
+///
+/// read() pulls from a socket straight into the parser, prepare() and
+/// commit() do the same for any other source:
+///     auto buf = parser.prepare(n);
+///     auto nbytes = read(fd, buf.data(), buf.size());
+///     auto msgs = parser.commit(nbytes);
+/// parsed messages view into the slab, bytes are only copied when a frame
+/// does not fit in the rest of the current slab.
 class TINYRPC_EXPORT Parser {
 public:
     Parser() noexcept;
@@ -16,6 +28,21 @@ public:
     Parser(Parser&&) noexcept;
     Parser& operator=(Parser&) = delete;
     Parser& operator=(Parser&&) noexcept;
+    /// bounds of the adaptive read size used by read()
+    void set_recv_size(size_t min, size_t max) noexcept;
+    /// frames declaring more bytes than this break the stream
+    void set_max_frame_size(size_t size) noexcept;
+    /// a frame declared a size over the maximum, nothing is parsed anymore
+    /// and the connection has to be closed
+    bool broken() const noexcept;
+    /// read from sock until it would block and append parsed messages to
+    /// msgs, false once the connection is closed, failed or broken
+    asyncio::Task<bool> read(asyncio::Socket& sock, std::vector<Message>& msgs) noexcept;
+    /// return a writable region of at least min_size bytes
+    std::span<char> prepare(size_t min_size) noexcept;
+    /// mark nbytes of the region returned by prepare as filled and parse them
+    std::vector<Message> commit(size_t nbytes) noexcept;
+    /// copy data in and parse it
     std::vector<Message> process(const char* data, size_t size) noexcept;
 private:
     struct impl;
@@ -0,0 +1,43 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+
+#include "../../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN(message)
+
+/// picks the size of the next read from what previous reads returned
+///
+/// a read that fills its buffer doubles the size up to max, two reads in a
+/// row returning less than half of it halve the size down to min.
+class RecvSizer {
+public:
+    inline RecvSizer(size_t min, size_t max) noexcept:
+        _min(min), _max(std::max(min, max)), _size(min) {}
+
+    inline size_t next() const noexcept { return _size; }
+    inline size_t min() const noexcept { return _min; }
+    inline size_t max() const noexcept { return _max; }
+
+    inline void record(size_t requested, size_t nbytes) noexcept {
+        if (nbytes >= requested) {
+            _size = std::min(std::max(_size, requested)*2, _max);
+            _short_reads = 0;
+        } else if (nbytes < _size/2) {
+            if (++_short_reads >= 2) {
+                _size = std::max(_size/2, _min);
+                _short_reads = 0;
+            }
+        } else {
+            _short_reads = 0;
+        }
+    }
+private:
+    size_t _min;
+    size_t _max;
+    size_t _size;
+    int _short_reads { 0 };
+};
+
+TINYRPC_NS_END
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include "tinyrpc_export.hpp"
+#include "tinyrpc_config.hpp"
+#include "../../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN(message)
+
+/// refcounted receive buffer
+///
+/// sockets read straight into slabs and parsed messages view into them, a
+/// slab returns to the per-thread pool once the last message referencing it
+/// is destroyed.
+class TINYRPC_EXPORT Slab {
+public:
+    class Ref {
+    public:
+        Ref() noexcept = default;
+        inline explicit Ref(Slab* slab) noexcept: _slab(slab) {}
+        inline Ref(const Ref& r) noexcept: _slab(r._slab) {
+            if (_slab) _slab->_refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        inline Ref(Ref&& r) noexcept: _slab(std::exchange(r._slab, nullptr)) {}
+        inline ~Ref() noexcept { reset(); }
+        inline Ref& operator=(const Ref& r) noexcept {
+            if (this != &r) {
+                reset();
+                _slab = r._slab;
+                if (_slab) _slab->_refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            return *this;
+        }
+        inline Ref& operator=(Ref&& r) noexcept {
+            if (this != &r) {
+                reset();
+                _slab = std::exchange(r._slab, nullptr);
+            }
+            return *this;
+        }
+        inline void reset() noexcept {
+            if (auto s = std::exchange(_slab, nullptr); s) {
+                Slab::release(s);
+            }
+        }
+        inline Slab* operator->() const noexcept { return _slab; }
+        inline explicit operator bool() const noexcept { return _slab; }
+    private:
+        Slab* _slab { nullptr };
+    };
+
+    /// get a slab with at least `capacity` bytes, from the pool when possible
+    static Ref acquire(size_t capacity) noexcept;
+
+    inline char* data() noexcept { return (char*)(this+1); }
+    inline size_t capacity() const noexcept { return _capacity; }
+    /// true if the caller holds the only reference
+    inline bool unique() const noexcept { return _refs.load(std::memory_order_acquire) == 1; }
+private:
+    std::atomic<size_t> _refs { 1 };
+    size_t _capacity;
+
+    inline explicit Slab(size_t capacity) noexcept: _capacity(capacity) {}
+    static void release(Slab* slab) noexcept;
+};
+
+TINYRPC_NS_END
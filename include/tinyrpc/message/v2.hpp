@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+#include <growable_buffer.hpp>
+
+#include "tinyrpc_config.hpp"
+#include "../../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN(message::v2)
+
+/// layout of version 2 frames, whose header is fixed size and little endian
+///
+///     0   u8   first byte of VERIFY_FLAG, frames of both versions start with it
+///     1   u8   VERSION, where version 1 frames have the second flag byte
+///     2   u8   flags, INDEXED | DEADLINE | STREAM | NOT_FOUND | OVERLOADED
+///              | BAD_REQUEST | TOO_LARGE
+///     3   u8   name size, 0 with INDEXED
+///     4   u32  body size
+///     8   u64  id
+///     16  u32  timeout in milliseconds, only with DEADLINE
+///         u32  method index with INDEXED, the name otherwise
+///
+/// the first HEADER_SIZE bytes tell the size of the whole frame, so it is
+/// parsed without looking at any byte twice. A response echoes the request
+/// header with NOT_FOUND set if the function is not known, OVERLOADED if
+/// the server shed the request, BAD_REQUEST if its arguments did not
+/// decode, TOO_LARGE if the response body did not fit in a u32.
+constexpr inline uint8_t VERSION = 2;
+constexpr inline size_t HEADER_SIZE = 16;
+constexpr inline size_t MAX_NAME_SIZE = 255;
+
+constexpr inline uint8_t INDEXED = 0x01;
+constexpr inline uint8_t DEADLINE = 0x02;
+constexpr inline uint8_t STREAM = 0x04;
+constexpr inline uint8_t NOT_FOUND = 0x10;
+constexpr inline uint8_t OVERLOADED = 0x20;
+constexpr inline uint8_t BAD_REQUEST = 0x40;
+constexpr inline uint8_t TOO_LARGE = 0x80;
+
+constexpr inline size_t FLAGS_POS = 2;
+constexpr inline size_t NAME_SIZE_POS = 3;
+constexpr inline size_t BODY_SIZE_POS = 4;
+constexpr inline size_t ID_POS = 8;
+
+template<typename T>
+inline T load(const char* p) noexcept {
+    T value;
+    std::memcpy(&value, p, sizeof(T));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+template<typename T>
+inline void store(char* p, T value) noexcept {
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    std::memcpy(p, &value, sizeof(T));
+}
+
+/// true if frame, of which at least two bytes are given, is a version 2 one
+inline bool is_v2(std::string_view frame) noexcept {
+    return (uint8_t)frame[1] == VERSION;
+}
+
+inline uint8_t flags(std::string_view frame) noexcept {
+    return (uint8_t)frame[FLAGS_POS];
+}
+
+/// offset of the method index or name
+inline size_t method_pos(uint8_t flags) noexcept {
+    return flags & DEADLINE ? HEADER_SIZE+sizeof(uint32_t) : HEADER_SIZE;
+}
+
+/// size of the header of frame, of which HEADER_SIZE bytes are given
+inline size_t header_size(std::string_view frame) noexcept {
+    auto f = flags(frame);
+    return method_pos(f) + (f & INDEXED ? sizeof(uint32_t) : (uint8_t)frame[NAME_SIZE_POS]);
+}
+
+/// append a request header with a body size of 0, either name or method is
+/// used depending on INDEXED, timeout only with DEADLINE
+inline std::span<char> write_header(
+    GrowableBuffer& out,
+    uint64_t id,
+    uint8_t flags,
+    uint32_t timeout,
+    std::string_view name,
+    uint32_t method
+) noexcept {
+    auto size = method_pos(flags) + (flags & INDEXED ? sizeof(method) : name.size());
+    auto header = out.malloc(size);
+    auto p = header.data();
+    p[0] = ((const char*)&VERIFY_FLAG)[0];
+    p[1] = VERSION;
+    p[FLAGS_POS] = flags;
+    p[NAME_SIZE_POS] = flags & INDEXED ? 0 : name.size();
+    store<uint32_t>(p+BODY_SIZE_POS, 0);
+    store<uint64_t>(p+ID_POS, id);
+    p += HEADER_SIZE;
+    if (flags & DEADLINE) {
+        store<uint32_t>(p, timeout);
+        p += sizeof(timeout);
+    }
+    if (flags & INDEXED) {
+        store<uint32_t>(p, method);
+    } else {
+        std::copy(name.begin(), name.end(), p);
+    }
+    return header;
+}
+
+TINYRPC_NS_END
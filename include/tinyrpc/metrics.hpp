@@ -0,0 +1,144 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <msgpack.hpp>
+
+#include "tinyrpc_export.hpp"
+#include "./dispatch_table.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// counters of one function, as returned by STATS_FUNC
+struct MethodStats {
+    std::string name {};
+    uint64_t calls { 0 };
+    /// calls dropped past their deadline or cancelled by the caller
+    uint64_t errors { 0 };
+    uint64_t bytes_in { 0 };
+    uint64_t bytes_out { 0 };
+    /// calls answered from the response cache, counted in calls as well
+    uint64_t cache_hits { 0 };
+    /// calls answered overloaded without running, counted in calls as well
+    uint64_t shed { 0 };
+    /// log2 histograms in nanoseconds, element i counts durations within
+    /// [2^(i-1), 2^i), trailing empty buckets are left out. Queue time is
+    /// spent from reading the request until the handler starts, handler
+    /// time until it returns.
+    std::vector<uint64_t> queue_time {};
+    std::vector<uint64_t> handler_time {};
+    MSGPACK_DEFINE_MAP(name, calls, errors, bytes_in, bytes_out, cache_hits, shed, queue_time, handler_time);
+};
+
+/// gauges of one open connection
+struct ConnectionStats {
+    int fd { -1 };
+    /// bytes waiting to be written
+    uint64_t write_queued { 0 };
+    /// calls dispatched but not answered yet
+    uint64_t inflight { 0 };
+    MSGPACK_DEFINE_MAP(fd, write_queued, inflight);
+};
+
+/// reply of STATS_FUNC, summed over all event loops of a server
+struct ServerStats {
+    std::vector<MethodStats> methods {};
+    std::vector<ConnectionStats> connections {};
+    /// requests of functions that are not registered
+    uint64_t not_found { 0 };
+    MSGPACK_DEFINE_MAP(methods, connections, not_found);
+};
+
+
+/// counters written by a single event loop and read by any thread, so
+/// updates are plain relaxed stores rather than locked read-modify-writes
+class TINYRPC_EXPORT MetricsShard {
+public:
+    using Counter = std::atomic<uint64_t>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Histogram {
+        std::array<Counter, 64> buckets {};
+
+        inline void record(Clock::duration d) noexcept {
+            auto ns = (uint64_t)std::max<Clock::rep>(d.count(), 0);
+            add(buckets[std::min<size_t>(std::bit_width(ns), buckets.size()-1)]);
+        }
+    };
+
+    struct Method {
+        Counter calls {};
+        Counter errors {};
+        Counter bytes_in {};
+        Counter bytes_out {};
+        Counter cache_hits {};
+        Counter shed {};
+        Histogram queue_time {};
+        Histogram handler_time {};
+    };
+
+    struct Connection {
+        int fd;
+        Counter write_queued {};
+        Counter inflight {};
+    };
+
+    using ConnectionHandle = std::list<Connection>::iterator;
+
+    /// methods: size of the frozen dispatch table
+    explicit MetricsShard(size_t methods) noexcept: _methods(methods) {}
+    MetricsShard(MetricsShard&) = delete;
+    MetricsShard& operator=(MetricsShard&) = delete;
+
+    static inline void add(Counter& counter, uint64_t n = 1) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static inline void set(Counter& counter, uint64_t n) noexcept {
+        counter.store(n, std::memory_order_relaxed);
+    }
+
+    inline Method& method(Message::MethodID id) noexcept { return _methods[id]; }
+    inline void not_found() noexcept { add(_not_found); }
+
+    ConnectionHandle open(int fd) noexcept;
+    void close(ConnectionHandle conn) noexcept;
+
+    /// add the counters of this shard to stats, from any thread
+    void collect(ServerStats& stats) noexcept;
+private:
+    // indexed by method id, atomics never move
+    std::deque<Method> _methods;
+    Counter _not_found {};
+    // only opening and closing connections take the lock
+    std::mutex _mutex {};
+    std::list<Connection> _connections {};
+};
+
+
+/// the shards of all event loops of a server
+class TINYRPC_EXPORT Metrics {
+public:
+    Metrics() noexcept = default;
+    Metrics(Metrics&) = delete;
+    Metrics& operator=(Metrics&) = delete;
+
+    /// a shard for a new event loop, it lives as long as the server
+    MetricsShard& add_shard(size_t methods) noexcept;
+    /// thread safe
+    ServerStats snapshot(const DispatchTable& table) noexcept;
+private:
+    std::mutex _mutex {};
+    std::deque<MetricsShard> _shards {};
+};
+
+TINYRPC_NS_END
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "tinyrpc_config.hpp"
+#include "../tinyrpc_ns.hpp"
+#include "./message.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// per-connection tuning, shared by Server and Client
+struct ConnectionOptions {
+    /// size of the read issued while a connection is idle
+    size_t min_recv_size { TINYRPC_DEFAULT_BUFFER_SIZE };
+    /// upper bound of the adaptive read size
+    size_t max_recv_size { TINYRPC_MAX_RECV_SIZE };
+    /// connections receiving a larger frame, header included, are closed
+    size_t max_frame_size { TINYRPC_MAX_FRAME_SIZE };
+    /// writers suspend once more bytes than this wait to be written
+    size_t write_high_watermark { TINYRPC_WRITE_HIGH_WATERMARK };
+    /// and resume once no more than this are left
+    size_t write_low_watermark { TINYRPC_WRITE_LOW_WATERMARK };
+    /// requests of a server connection that may run at once before it
+    /// stops reading, calls completing on the spot do not count
+    size_t max_inflight { TINYRPC_MAX_INFLIGHT };
+    /// received chunk bytes a stream holds before the connection stops
+    /// reading until its reader caught up, no other frame of the
+    /// connection is read meanwhile, CANCEL frames included
+    size_t max_stream_buffered { TINYRPC_STREAM_MAX_BUFFERED };
+    /// highest frame version spoken, 1 keeps clients from negotiating and
+    /// servers from agreeing to version 2, see PROTOCOL_FUNC
+    uint8_t frame_version { FRAME_VERSION };
+};
+
+TINYRPC_NS_END
@@ -0,0 +1,84 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "tinyrpc_export.hpp"
+#include "./message.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// opts a function into the response cache of the server, meant for
+/// functions whose result only depends on their arguments
+struct CachePolicy {
+    /// how long a response is answered from the cache, 0 disables caching
+    std::chrono::milliseconds ttl { 0 };
+
+    inline bool enabled() const noexcept { return ttl.count() > 0; }
+};
+
+/// serialized response bodies keyed by function and request body, owned
+/// by a single event loop
+///
+/// bounded by a byte budget, entries past their ttl are dropped when met
+/// and CLOCK eviction makes room otherwise: the hand clears the referenced
+/// bit of entries hit since it last passed and evicts those without it.
+/// Lookups neither allocate nor copy, entries are found by hash and then
+/// compared in full.
+class TINYRPC_EXPORT ResponseCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// budget: bytes the entries may hold, 0 keeps nothing
+    explicit ResponseCache(size_t budget) noexcept: _budget(budget) {}
+    ResponseCache(ResponseCache&) = delete;
+    ResponseCache& operator=(ResponseCache&) = delete;
+
+    /// the response body to request of method, valid until the next insert
+    std::optional<std::string_view> find(Message::MethodID method, std::string_view request, Clock::time_point now) noexcept;
+    /// keep response until expires, replacing one to the same request
+    void insert(
+        Message::MethodID method,
+        std::string&& request,
+        std::string_view response,
+        Clock::time_point expires
+    ) noexcept;
+    inline size_t size() const noexcept { return _index.size(); }
+    inline size_t bytes() const noexcept { return _bytes; }
+private:
+    struct Slot {
+        uint64_t hash { 0 };
+        Message::MethodID method { Message::invalid_method };
+        bool used { false };
+        bool referenced { false };
+        Clock::time_point expires {};
+        std::string request {};
+        std::string response {};
+
+        /// memory held rather than bytes used, the budget bounds the former
+        static inline size_t cost(const std::string& request, const std::string& response) noexcept {
+            return sizeof(Slot) + request.capacity() + response.capacity();
+        }
+        inline size_t cost() const noexcept { return cost(request, response); }
+    };
+
+    size_t _budget;
+    size_t _bytes { 0 };
+    size_t _hand { 0 };
+    std::vector<Slot> _slots {};
+    std::vector<uint32_t> _free {};
+    // hash to slot, requests of colliding hashes replace each other
+    std::unordered_map<uint64_t, uint32_t> _index {};
+
+    void evict(uint32_t slot) noexcept;
+    /// evict the next entry the hand finds unreferenced
+    void evict_one(Clock::time_point now) noexcept;
+};
+
+TINYRPC_NS_END
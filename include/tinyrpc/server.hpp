@@ -3,7 +3,14 @@
 #include <growable_buffer.hpp>
 
 #include "tinyrpc_export.hpp"
+#include "./admission.hpp"
+#include "./handler.hpp"
+#include "./local.hpp"
 #include "./message.hpp"
+#include "./options.hpp"
+#include "./response_cache.hpp"
+#include "./stream.hpp"
+#include "./unix_socket.hpp"
 #include "../tinyrpc_ns.hpp"
 
 
@@ -11,6 +18,7 @@ TINYRPC_NS_BEGIN()
 
 using Function = std::function<void(Message&&, GrowableBuffer&)>;
 using AFunction = std::function<ASYNCIO_NS::Task<>(Message&&, GrowableBuffer&)>;
+using StreamFunction = std::function<ASYNCIO_NS::Task<>(Stream&)>;
 
 class TINYRPC_EXPORT Server {
 public:
@@ -19,10 +27,54 @@ public:
     Server(Server&&) noexcept;
     Server& operator=(Server&) = delete;
     Server& operator=(Server&&) noexcept;
+    /// applies to connections accepted afterwards
+    void set_options(const ConnectionOptions& options) noexcept;
+    /// number of workers running Execution::WorkerPool handlers, the pool
+    /// is only started if such a handler is registered
+    void set_thread_pool_size(size_t size) noexcept;
+    /// bytes of requests and responses each event loop caches for functions
+    /// registered with a CachePolicy, see ResponseCache
+    void set_response_cache_size(size_t bytes) noexcept;
+    /// when event loops shed requests that queued too long, see
+    /// AdmissionControl
+    void set_admission(const AdmissionOptions& options) noexcept;
+    /// a host of the form unix:PATH listens on a unix domain socket, see
+    /// UNIX_PREFIX
     void init(const char* host, short port, int max_listen_num) noexcept;
     asyncio::Task<> run() noexcept;
+    /// run num_loops event loops, each on its own thread accepting through
+    /// its own SO_REUSEPORT listener, the calling thread drives the first
+    /// one and never returns. Registered functions may then be called
+    /// concurrently and have to be thread safe.
+    void serve(size_t num_loops) noexcept;
+    /// the endpoint clients of this process connect to, it freezes the
+    /// functions like run() does and has to be taken before serving, taking
+    /// it again returns the same endpoint. The server has to outlive the
+    /// clients, which may call from any thread.
+    ///
+    /// only calls matching the signature of the function exactly skip
+    /// encoding, others encode the request and copy the response into the
+    /// buffer of the client like a connection would. Functions not on the
+    /// worker pool, async ones included, run on the thread of the caller,
+    /// concurrently with the event loops, and have to be thread safe then.
+    LocalEndpoint& local() noexcept;
     void register_func(const std::string& name, Function&& func) noexcept;
     void register_afunc(const std::string& name, AFunction&& afunc) noexcept;
+    /// the function reads the chunks of the caller and writes its own to the
+    /// stream, which is finished once it returns
+    void register_stream(const std::string& name, StreamFunction&& func) noexcept;
+    /// functions can only be registered before run(), async handlers
+    /// always run inline, cache answers repeated requests without calling
+    /// the function, see CachePolicy
+    void register_handler(
+        const std::string& name,
+        Handler&& handler,
+        Execution execution = Execution::Inline,
+        CachePolicy cache = {}
+    ) noexcept;
+    /// calls of the registered function name beyond max_running running at
+    /// once on an event loop are answered with RPCError::Overloaded
+    void limit(const std::string& name, size_t max_running) noexcept;
 private:
     struct impl;
     impl* _pimpl;
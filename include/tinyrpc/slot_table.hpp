@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <utility>
+
+#include "./message.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// values keyed by request ids that the table hands out itself
+///
+/// an id is the index of a slot in its low 32 bits and the generation of
+/// that slot in its high 32 bits. Finding and releasing are an index plus
+/// a compare, a released slot is reused through a free list after bumping
+/// its generation, so a late response to an id released before misses
+/// instead of matching the slot's next user. Slots never move once created
+/// and are only allocated while the table grows, 0 is never a valid id.
+template<typename T>
+class SlotTable {
+public:
+    using ID = Message::ID;
+
+    explicit SlotTable(size_t capacity = 0) noexcept {
+        while (_slots.size() < capacity) {
+            create();
+        }
+    }
+    SlotTable(SlotTable&) = delete;
+    SlotTable& operator=(SlotTable&) = delete;
+
+    /// take a free slot, value constructed from args
+    template<typename... Args>
+    std::pair<ID, T&> acquire(Args&&... args) noexcept {
+        if (_free == npos) {
+            create();
+        }
+        auto index = _free;
+        auto& slot = _slots[index];
+        _free = slot.next;
+        slot.next = npos;
+        auto& value = slot.value.emplace(std::forward<Args>(args)...);
+        ++_size;
+        return { make_id(index, slot.generation), value };
+    }
+
+    /// nullptr unless id is in use
+    inline T* find(ID id) noexcept {
+        auto index = (uint32_t)id;
+        if (index >= _slots.size()) {
+            return nullptr;
+        }
+        auto& slot = _slots[index];
+        if (slot.generation != (uint32_t)(id >> 32) || !slot.value) {
+            return nullptr;
+        }
+        return &*slot.value;
+    }
+
+    /// no op unless id is in use
+    void release(ID id) noexcept {
+        if (!find(id)) {
+            return;
+        }
+        auto index = (uint32_t)id;
+        auto& slot = _slots[index];
+        slot.value.reset();
+        // 0 is left out so that no id is ever 0
+        if (++slot.generation == 0) {
+            slot.generation = 1;
+        }
+        slot.next = _free;
+        _free = index;
+        --_size;
+    }
+
+    inline size_t size() const noexcept { return _size; }
+    inline bool empty() const noexcept { return _size == 0; }
+
+    /// f(id, value) for every slot in use, f must not release others
+    template<typename F>
+    void for_each(F&& f) noexcept {
+        for (uint32_t index = 0; index < _slots.size(); ++index) {
+            auto& slot = _slots[index];
+            if (slot.value) {
+                f(make_id(index, slot.generation), *slot.value);
+            }
+        }
+    }
+private:
+    static constexpr uint32_t npos = -1;
+
+    struct Slot {
+        uint32_t generation { 1 };
+        uint32_t next { npos };
+        std::optional<T> value {};
+    };
+
+    // a deque, values are waited on in place
+    std::deque<Slot> _slots {};
+    uint32_t _free { npos };
+    size_t _size { 0 };
+
+    static inline ID make_id(uint32_t index, uint32_t generation) noexcept {
+        return (ID)generation << 32 | index;
+    }
+
+    void create() noexcept {
+        auto index = (uint32_t)_slots.size();
+        _slots.emplace_back().next = _free;
+        _free = index;
+    }
+};
+
+TINYRPC_NS_END
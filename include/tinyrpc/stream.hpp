@@ -0,0 +1,128 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <asyncio.hpp>
+
+#include "tinyrpc_config.hpp"
+#include "tinyrpc_export.hpp"
+#include "./message.hpp"
+#include "./write_queue.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+class Stream;
+
+/// streams of a connection holding more unread chunks than they may, the
+/// connection stops reading until their readers caught up
+class TINYRPC_EXPORT StreamBacklog {
+public:
+    StreamBacklog() noexcept = default;
+    StreamBacklog(StreamBacklog&) = delete;
+    StreamBacklog& operator=(StreamBacklog&) = delete;
+
+    inline void add(std::weak_ptr<Stream> stream) noexcept { _streams.push_back(std::move(stream)); }
+    /// wake drained() to look at the streams again
+    inline void notify() noexcept {
+        if (!_ev.is_set()) _ev.set();
+    }
+    /// suspend until no stream added is backlogged anymore
+    asyncio::Task<> drained() noexcept;
+private:
+    // dropped streams expire, so waiting never keeps one alive
+    std::vector<std::weak_ptr<Stream>> _streams {};
+    asyncio::Event<> _ev {};
+};
+
+/// one end of a streaming call, a sequence of chunks in either direction
+///
+/// every chunk travels in a frame of its own that repeats the header of
+/// the call marked as a stream chunk, an empty chunk ends the stream of its
+/// sender. Received chunks wait for the reader, once more than
+/// max_buffered bytes of them do the stream joins the backlog of its
+/// connection, so memory per call is bounded by that rather than the size
+/// of the whole payload.
+class TINYRPC_EXPORT Stream: public std::enable_shared_from_this<Stream> {
+public:
+    using Wake = std::move_only_function<void()>;
+
+    /// header: frame header of the call including its body size field,
+    /// wake: makes the writer of queue flush, backlog: of the connection,
+    /// both have to outlive the stream
+    Stream(
+        std::string_view header,
+        WriteQueue& queue,
+        Wake&& wake,
+        StreamBacklog& backlog,
+        size_t max_buffered = TINYRPC_STREAM_MAX_BUFFERED
+    ) noexcept;
+    ~Stream() noexcept;
+    Stream(Stream&) = delete;
+    Stream& operator=(Stream&) = delete;
+
+    inline Message::ID id() const noexcept {
+        return Message::id(_header);
+    }
+    /// next chunk of the peer, nullopt once it ended its stream
+    asyncio::Task<std::optional<Message>> read() noexcept;
+    /// send a chunk, false once this end finished or the connection closed
+    /// or if it is too large for a frame, empty chunks are not sent since
+    /// they would end the stream
+    bool write(std::string_view chunk) noexcept;
+    /// suspend while the connection has more than its high watermark
+    /// queued, writers of many chunks await it between writes
+    asyncio::Task<> drained() noexcept;
+    /// end the stream of this side, later writes fail
+    void finish() noexcept;
+    inline bool finished() const noexcept { return _finished; }
+    inline bool peer_finished() const noexcept { return _peer_finished; }
+    /// the peer does not know the function
+    inline bool func_not_found() const noexcept { return _not_found; }
+    /// chunk bytes received and sent so far
+    inline size_t bytes_read() const noexcept { return _bytes_read; }
+    inline size_t bytes_written() const noexcept { return _bytes_written; }
+
+    /// hand a received frame of this call to the stream, which is owned by
+    /// a shared_ptr
+    void push(Message&& msg) noexcept;
+    /// more chunk bytes than max_buffered wait for a reader and the peer may
+    /// send more
+    inline bool backlogged() const noexcept {
+        return _buffered > _max_buffered && _reading && !_peer_finished;
+    }
+    /// nothing reads the stream anymore, chunks arriving later are dropped
+    void stop_reading() noexcept;
+    /// the connection is gone, wake up a pending read and fail writes
+    void close() noexcept;
+    /// done is called once both ends finished or the stream is destroyed,
+    /// whichever comes first, the connection forgets the call then
+    inline void on_done(Wake&& done) noexcept { _done = std::move(done); }
+private:
+    std::string _header;
+    WriteQueue* _queue;
+    Wake _wake;
+    Wake _done {};
+    StreamBacklog* _backlog;
+    std::deque<Message> _chunks {};
+    size_t _buffered { 0 };
+    size_t _max_buffered;
+    asyncio::Event<> _ev {};
+    bool _finished { false };
+    bool _peer_finished { false };
+    bool _not_found { false };
+    bool _reading { true };
+    size_t _bytes_read { 0 };
+    size_t _bytes_written { 0 };
+
+    void write_frame(std::string_view chunk) noexcept;
+    void check_done() noexcept;
+};
+
+TINYRPC_NS_END
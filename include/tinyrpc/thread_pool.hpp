@@ -0,0 +1,75 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <asyncio.hpp>
+
+#include "tinyrpc_export.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// callbacks posted from any thread and run on the event loop owning the
+/// mailbox, woken through an eventfd
+class TINYRPC_EXPORT Mailbox {
+public:
+    using Callback = std::move_only_function<void()>;
+
+    /// mailbox of the calling thread's event loop, created on first use
+    static Mailbox& current() noexcept;
+
+    Mailbox(Mailbox&) = delete;
+    Mailbox& operator=(Mailbox&) = delete;
+    /// thread safe
+    void post(Callback&& callback) noexcept;
+private:
+    int _fd;
+    std::mutex _mutex {};
+    std::vector<Callback> _callbacks {};
+    bool _notified { false };
+
+    Mailbox() noexcept;
+    asyncio::Task<> drain_forever() noexcept;
+};
+
+
+/// fixed size pool of worker threads for blocking work
+class TINYRPC_EXPORT ThreadPool {
+public:
+    using Job = std::move_only_function<void()>;
+
+    explicit ThreadPool(size_t size) noexcept;
+    ThreadPool(ThreadPool&) = delete;
+    ThreadPool& operator=(ThreadPool&) = delete;
+    ~ThreadPool() noexcept;
+
+    void submit(Job&& job) noexcept;
+
+    /// run f on a worker, the awaiting coroutine resumes on its own event
+    /// loop once f returned
+    template<typename F>
+    asyncio::Task<> run(F&& f) noexcept {
+        asyncio::Event<> done;
+        auto& mailbox = Mailbox::current();
+        submit([&f, &done, &mailbox] {
+            f();
+            mailbox.post([&done] { done.set(); });
+        });
+        co_await done.wait();
+    }
+private:
+    std::mutex _mutex {};
+    std::condition_variable _cv {};
+    std::deque<Job> _jobs {};
+    bool _stop { false };
+    std::vector<std::thread> _workers {};
+
+    void work() noexcept;
+};
+
+TINYRPC_NS_END
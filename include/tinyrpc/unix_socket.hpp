@@ -0,0 +1,33 @@
+#pragma once
+#include <optional>
+#include <string_view>
+
+#include "tinyrpc_export.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// hosts starting with this name a unix domain socket instead, the port is
+/// ignored. The path follows it, a leading '@' puts it into the abstract
+/// namespace, e.g. "unix:/run/app.sock" or "unix:@app"
+constexpr inline std::string_view UNIX_PREFIX = "unix:";
+
+/// the path host names, nullopt if it is a tcp host
+inline std::optional<std::string_view> unix_path(std::string_view host) noexcept {
+    if (!host.starts_with(UNIX_PREFIX)) {
+        return std::nullopt;
+    }
+    return host.substr(UNIX_PREFIX.size());
+}
+
+/// a nonblocking AF_UNIX stream socket listening on path, a stale socket
+/// file left there is removed first while one a server still accepts on
+/// fails with EADDRINUSE. -1 on failure with errno set
+TINYRPC_EXPORT int listen_unix(std::string_view path, int backlog) noexcept;
+
+/// a nonblocking AF_UNIX stream socket connected to path, which never
+/// waits, a full backlog fails with EAGAIN. -1 on failure with errno set
+TINYRPC_EXPORT int connect_unix(std::string_view path) noexcept;
+
+TINYRPC_NS_END
@@ -1,6 +1,9 @@
 #pragma once
+#include <string>
+#include <string_view>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 
 #include <asyncio.hpp>
 
@@ -18,6 +21,7 @@ template<typename R, typename... Args>
 struct function_traits<R (*)(Args...)> {
     using return_type = R;
     using args_type = std::tuple<std::decay_t<Args>...>;
+    using raw_args_type = std::tuple<Args...>;
 };
 
 
@@ -42,16 +46,17 @@ constexpr decltype(auto) get_first_arg(Arg&& arg, Args&&... args) noexcept {
 }
 
 
+/// the first argument is a message by value, pointer or reference
 template<typename... Args>
 struct proto_arg {
-    static constexpr bool value = concepts::ProtoType<std::decay_t<typename first_arg<Args...>::type>>;
+    static constexpr bool value = concepts::ProtoType<
+        std::remove_cv_t<std::remove_pointer_t<std::decay_t<typename first_arg<Args...>::type>>>
+    >;
 };
 
 
 template<typename... Args>
-struct proto_arg<std::tuple<Args...>> {
-    static constexpr bool value = concepts::ProtoType<std::decay_t<typename first_arg<Args...>::type>>;
-};
+struct proto_arg<std::tuple<Args...>>: proto_arg<Args...> {};
 
 
 template<typename T>
@@ -90,6 +95,23 @@ decltype(auto) expand_tuple_call(F&& f, std::tuple<Args...>&& args) noexcept {
 }
 
 
+/// callable with the overloads of all fs
+template<typename... F>
+struct overloaded: F... {
+    using F::operator()...;
+};
+
+
+/// transparent hash, lets string keyed maps be searched with string_view
+struct string_hash {
+    using is_transparent = void;
+
+    inline size_t operator()(std::string_view s) const noexcept {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+
 template<typename T>
 void free_and_null(T*& ptr) noexcept {
     if (auto p = std::exchange(ptr, nullptr); p) {
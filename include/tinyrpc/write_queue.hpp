@@ -0,0 +1,71 @@
+#pragma once
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <asyncio.hpp>
+#include <growable_buffer.hpp>
+
+#include "tinyrpc_config.hpp"
+#include "tinyrpc_export.hpp"
+#include "../tinyrpc_ns.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+/// outgoing data of one connection
+///
+/// producers append complete frames to buffer() or push() ready-made
+/// buffers, frames produced over several suspensions are built in an
+/// acquire()d buffer and pushed once complete. flush() hands every pending
+/// region to the kernel with one sendmsg, without copying it first. Past
+/// the high watermark producers are expected to wait for drained() before
+/// adding more.
+class TINYRPC_EXPORT WriteQueue {
+public:
+    WriteQueue() noexcept = default;
+    WriteQueue(WriteQueue&) = delete;
+    WriteQueue& operator=(WriteQueue&) = delete;
+
+    /// the buffer new frames are appended to
+    inline GrowableBuffer& buffer() noexcept { return _open; }
+    /// an empty buffer, reused from written ones when possible
+    GrowableBuffer acquire() noexcept;
+    /// enqueue a buffer holding complete frames
+    void push(GrowableBuffer&& buffer) noexcept;
+    inline bool empty() const noexcept { return _pending.empty() && _open.readable_bytes() == 0; }
+    /// bytes queued and not yet written
+    inline size_t size() const noexcept { return _queued + _open.readable_bytes(); }
+    inline void set_watermarks(size_t high, size_t low) noexcept {
+        _high = high;
+        _low = std::min(low, high);
+    }
+    inline bool congested() const noexcept { return size() > _high; }
+    /// complete once no more than the low watermark is queued
+    asyncio::Task<> drained() noexcept;
+    /// write out everything pending, false if the socket failed
+    asyncio::Task<bool> flush(asyncio::Socket& sock) noexcept;
+    /// drop everything pending
+    void clear() noexcept;
+private:
+    struct Pending {
+        GrowableBuffer buffer;
+        // not yet written part of buffer
+        std::string_view data {};
+    };
+
+    GrowableBuffer _open {};
+    std::deque<Pending> _pending {};
+    // bytes of _pending not yet written
+    size_t _queued { 0 };
+    size_t _high { TINYRPC_WRITE_HIGH_WATERMARK };
+    size_t _low { TINYRPC_WRITE_LOW_WATERMARK };
+    asyncio::Event<> _drained {};
+    // fully written buffers kept for reuse
+    std::vector<GrowableBuffer> _spare {};
+
+    void seal() noexcept;
+    void consume(size_t nbytes) noexcept;
+};
+
+TINYRPC_NS_END
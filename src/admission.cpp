@@ -0,0 +1,42 @@
+#include <algorithm>
+
+#include "tinyrpc/admission.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+void AdmissionControl::observe(Clock::duration delay, Clock::time_point now) noexcept {
+    if (now >= _interval_end) {
+        // the smallest delay of an interval tells a standing queue from a
+        // burst, which some request always gets through without waiting. An
+        // interval without requests, or long gone, proves nothing.
+        auto sampled = _min_delay != Clock::duration::max() && now < _interval_end + _options.interval;
+        _overloaded = sampled && _min_delay > _options.target;
+        _min_delay = Clock::duration::max();
+        _interval_end = now + _options.interval;
+    }
+    _min_delay = std::min(_min_delay, delay);
+}
+
+std::optional<AdmissionControl::Ticket> AdmissionControl::admit(
+    Message::MethodID method,
+    size_t max_running,
+    Clock::duration delay,
+    Clock::time_point now
+) noexcept {
+    if (_options.target.count() > 0) {
+        observe(delay, now);
+        // a loop keeping up never sheds, however long one batch waited
+        if (_overloaded && delay > _options.target) {
+            return std::nullopt;
+        }
+    }
+    auto& running = _running[method];
+    if (max_running && running >= max_running) {
+        return std::nullopt;
+    }
+    ++running;
+    return Ticket(this, method);
+}
+
+TINYRPC_NS_END
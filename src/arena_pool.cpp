@@ -0,0 +1,74 @@
+#include "tinyrpc_config.hpp"
+#include "tinyrpc/arena.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+// arenas kept per thread beyond this are freed on release
+static constexpr size_t max_free_arenas = 64;
+
+struct ArenaPool::Entry {
+    ArenaPool& pool;
+    std::unique_ptr<char[]> block;
+    google::protobuf::Arena arena;
+
+    explicit Entry(ArenaPool& pool) noexcept:
+        pool(pool),
+        block(new char[TINYRPC_ARENA_BLOCK_SIZE]),
+        arena(options(block.get())) {}
+
+    static google::protobuf::ArenaOptions options(char* block) noexcept {
+        google::protobuf::ArenaOptions options;
+        options.initial_block = block;
+        options.initial_block_size = TINYRPC_ARENA_BLOCK_SIZE;
+        return options;
+    }
+};
+
+ArenaPool::Lease::Lease() noexcept = default;
+ArenaPool::Lease::Lease(Lease&& lease) noexcept = default;
+
+ArenaPool::Lease& ArenaPool::Lease::operator=(Lease&& lease) noexcept {
+    // the entry held before goes back through the destructor of lease
+    std::swap(_entry, lease._entry);
+    return *this;
+}
+
+ArenaPool::Lease::Lease(std::unique_ptr<Entry>&& entry) noexcept: _entry(std::move(entry)) {}
+
+ArenaPool::Lease::~Lease() noexcept {
+    if (_entry) {
+        auto& pool = _entry->pool;
+        pool.release(std::move(_entry));
+    }
+}
+
+google::protobuf::Arena* ArenaPool::Lease::get() const noexcept {
+    return _entry ? &_entry->arena : nullptr;
+}
+
+ArenaPool& ArenaPool::local() noexcept {
+    thread_local ArenaPool pool;
+    return pool;
+}
+
+ArenaPool::~ArenaPool() noexcept = default;
+
+ArenaPool::Lease ArenaPool::acquire() noexcept {
+    if (_free.empty()) {
+        return Lease(std::make_unique<Entry>(*this));
+    }
+    auto entry = std::move(_free.back());
+    _free.pop_back();
+    return Lease(std::move(entry));
+}
+
+void ArenaPool::release(std::unique_ptr<Entry>&& entry) noexcept {
+    // frees everything but the initial block, which the next request reuses
+    entry->arena.Reset();
+    if (_free.size() < max_free_arenas) {
+        _free.push_back(std::move(entry));
+    }
+}
+
+TINYRPC_NS_END
@@ -1,44 +1,127 @@
+#include <algorithm>
+#include <expected>
+#include <limits>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
 #include <spdlog/spdlog.h>
-#include <spdlog/fmt/bin_to_hex.h>
 
 #include <growable_buffer.hpp>
 
 #include "tinyrpc/client.hpp"
+#include "tinyrpc/deadline_timer.hpp"
 #include "tinyrpc/message/parser.hpp"
+#include "tinyrpc/slot_table.hpp"
+#include "tinyrpc/unix_socket.hpp"
 #include "tinyrpc/utils.hpp"
+#include "tinyrpc/write_queue.hpp"
 
 
 TINYRPC_NS_BEGIN()
 
 struct Client::impl {
+    /// an identical call waiting for the result of a Flight or its own timeout
+    struct Follower {
+        asyncio::Event<> ev {};
+        bool timed_out { false };
+    };
+
+    /// a request of a coalesced function, identical calls wait for its result
+    struct Flight {
+        // owned by the waiting calls, which remove themselves once resumed
+        std::vector<Follower*> followers {};
+        std::expected<Message, RPCError> result { std::unexpect, RPCError::ConnectionClosed };
+        // false if the first call timed out or was cancelled, the result
+        // is not meant for the others then
+        bool settled { false };
+    };
+
+    /// a call waiting for its response or an open stream
+    struct Pending {
+        asyncio::Event<Message> ev {};
+        bool timed_out { false };
+        // owned by the caller, released once both ends finished
+        std::optional<std::weak_ptr<Stream>> stream { std::nullopt };
+    };
+
     asyncio::Socket sock;
     asyncio::Event<> ev;
-    GrowableBuffer write_buffer;
-    std::unordered_map<Message::ID, asyncio::Event<Message>> waits;
+    WriteQueue write_queue;
+    ConnectionOptions options {};
+    DeadlineTimer timer;
+    // hands out the ids of requests, grows on demand
+    SlotTable<Pending> pending { 64 };
+    // live batches, the writer is not woken while there are any
+    size_t batches { 0 };
+    // filled by fetch_method_table, empty means calling by name
+    std::unordered_map<std::string, Message::MethodID, utils::string_hash, std::equal_to<>> method_ids;
+    // frame version of requests, raised once the server answered PROTOCOL_FUNC
+    uint8_t version { 1 };
+    // streams holding too many unread chunks, reading waits for them
+    StreamBacklog backlog {};
     std::optional<asyncio::Task<>> read_task { std::nullopt };
     std::optional<asyncio::Task<>> write_task { std::nullopt };
+    // set while connected in process
+    LocalEndpoint* local { nullptr };
+    MetricsShard* local_shard { nullptr };
+    // request and response buffers of in-process calls, kept for reuse
+    std::vector<GrowableBuffer> local_buffers {};
+    // functions whose identical calls share a request, see Client::coalesce
+    std::unordered_set<std::string, utils::string_hash, std::equal_to<>> coalesced {};
+    // requests of those in flight by name and body
+    std::unordered_map<std::string, std::shared_ptr<Flight>, utils::string_hash, std::equal_to<>> flights {};
 
-    static inline Message::ID generate_message_id() noexcept {
-        static Message::ID id = 0;
-        return ++id;
+    ~impl() noexcept {
+        disconnect();
     }
 
-    ~impl() noexcept {
+    void disconnect() noexcept {
         if (read_task) {
             read_task->cancel();
+            read_task.reset();
         }
         if (write_task) {
             write_task->cancel();
+            write_task.reset();
+            write_queue.clear();
         }
+        // open streams may outlive the client, they must not call back into it
+        pending.for_each([this](Message::ID id, Pending& entry) {
+            if (!entry.stream) {
+                return;
+            }
+            if (auto stream = entry.stream->lock(); stream) {
+                stream->close();
+            }
+            pending.release(id);
+        });
+        local = nullptr;
+        local_shard = nullptr;
     }
 
     asyncio::Task<bool> connect(const char* host, short port) noexcept {
-        auto res = co_await sock.connect(host, port);
-        if (res == -1) {
-            std::perror(std::format("({})failed to connect to {}:{}", errno, host, port).c_str());
-            co_return false;
+        if (auto path = unix_path(host); path) {
+            auto fd = connect_unix(*path);
+            if (fd == -1) {
+                std::perror(std::format("({})failed to connect to {}", errno, host).c_str());
+                co_return false;
+            }
+            sock = asyncio::Socket(fd);
+            SPDLOG_INFO("successfully connect to {}", host);
+        } else {
+            auto res = co_await sock.connect(host, port);
+            if (res == -1) {
+                std::perror(std::format("({})failed to connect to {}:{}", errno, host, port).c_str());
+                co_return false;
+            }
+            SPDLOG_INFO("successfully connect to {}:{}", host, port);
         }
-        SPDLOG_INFO("successfully connect to {}:{}", host, port);
+        local = nullptr;
+        local_shard = nullptr;
+        method_ids.clear();
+        version = 1;
+        write_queue.set_watermarks(options.write_high_watermark, options.write_low_watermark);
 
         if (read_task) {
             read_task->cancel();
@@ -46,7 +129,7 @@ struct Client::impl {
         read_task = read_forever();
         if (write_task) {
             write_task->cancel();
-            write_buffer = {};
+            write_queue.clear();
         }
         write_task = write_forever();
         co_return true;
@@ -54,94 +137,405 @@ struct Client::impl {
 
     void handle_message(Message&& msg) noexcept {
         auto id = msg.id();
-        if (waits.contains(id)) {
-            SPDLOG_DEBUG("wake up coroutine to consume message {}", id);
-            waits[id].set(std::move(msg));
-        } else [[unlikely]] {
+        auto entry = pending.find(id);
+        if (!entry) [[unlikely]] {
             SPDLOG_WARN("seems that no coroutine waiting for message {}", id);
+        } else if (entry->stream) {
+            // the slot is released by the stream once done, see open_stream
+            if (auto stream = entry->stream->lock(); stream) {
+                stream->push(std::move(msg));
+            } else {
+                pending.release(id);
+            }
+        } else if (!entry->ev.is_set()) {
+            SPDLOG_DEBUG("wake up coroutine to consume message {}", id);
+            entry->ev.set(std::move(msg));
         }
     }
 
     asyncio::Task<> read_forever() noexcept {
-        char temp_buffer[TINYRPC_DEFAULT_BUFFER_SIZE];
         message::Parser message_parser;
+        message_parser.set_recv_size(options.min_recv_size, options.max_recv_size);
+        message_parser.set_max_frame_size(options.max_frame_size);
+        std::vector<Message> msgs;
         while (true) {
-            auto res = co_await sock.read(temp_buffer, TINYRPC_DEFAULT_BUFFER_SIZE);
-            if (!res) {
-                SPDLOG_ERROR("error while read from fd {}: {}", sock.fd(), res.error());
-                break;
-            }
-            auto nbytes = *res;
-            SPDLOG_DEBUG(
-                "recv {} bytes data:{}",
-                nbytes,
-                spdlog::to_hex(std::span(temp_buffer, (size_t)nbytes))
-            );
-            auto msgs = message_parser.process(temp_buffer, *res);
+            co_await backlog.drained();
+            auto alive = co_await message_parser.read(sock, msgs);
             for (auto& msg : msgs) {
                 handle_message(std::move(msg));
             }
+            msgs.clear();
+            if (!alive) {
+                break;
+            }
         }
         // notify all coroutine that are waiting for message
-        for (auto& [_, ev] : waits) {
-            if (!ev.is_set()) {
-                ev.set();
+        pending.for_each([this](Message::ID id, Pending& entry) {
+            if (!entry.stream) {
+                if (!entry.ev.is_set()) {
+                    entry.ev.set();
+                }
+                return;
             }
-        }
+            if (auto stream = entry.stream->lock(); stream) {
+                stream->close();
+            }
+            pending.release(id);
+        });
         SPDLOG_INFO("stop read task for fd", sock.fd());
         read_task.reset();
         write_task->cancel();
         write_task.reset();
-        write_buffer = {};
+        write_queue.clear();
     }
 
     asyncio::Task<> write_forever() noexcept {
         SPDLOG_INFO("start write task for fd {}", sock.fd());
-        char temp_buffer[TINYRPC_DEFAULT_BUFFER_SIZE];
         while (true) {
-            if (write_buffer.readable_bytes() == 0) {
+            if (write_queue.empty()) {
                 SPDLOG_DEBUG("empty write bufer, start waiting");
                 co_await ev.wait();
             }
-            auto nbytes = std::min(TINYRPC_DEFAULT_BUFFER_SIZE, write_buffer.readable_bytes());
-            auto view = write_buffer.read(nbytes);
-            std::copy(view.begin(), view.end(), temp_buffer);
-            auto res = co_await sock.write(temp_buffer, nbytes);
-            if (!res) {
-                SPDLOG_ERROR("error while write to fd {}: {}", sock.fd(), res.error());
+            if (!co_await write_queue.flush(sock)) {
                 exit(EXIT_FAILURE);
             }
-            SPDLOG_DEBUG(
-                "write {} bytes data to fd {}:{}",
-                nbytes,
-                sock.fd(),
-                spdlog::to_hex(std::span(temp_buffer, nbytes))
-            );
         }
         write_task.reset();
-        write_buffer = {};
+        write_queue.clear();
+    }
+
+    /// timeout: milliseconds, 0 sends no deadline
+    void send_request(Message::ID id, std::string_view name, std::string_view body, Message::Timeout timeout = 0) noexcept {
+        send_request(id, name, [body](GrowableBuffer& out) {
+            if (!body.empty()) out.write(body);
+        }, timeout);
+    }
+
+    /// the header is written first and its body size patched once write
+    /// is done, false if the body did not fit and nothing was sent
+    bool send_request(Message::ID id, std::string_view name, const BodyWriter& write, Message::Timeout timeout = 0) noexcept {
+        if (write_request(write_queue.buffer(), id, name, write, timeout) == 0) {
+            return false;
+        }
+        wake_writer();
+        return true;
+    }
+
+    /// append a request frame to write_buffer, returns the size of its header
+    /// or 0 if the body did not fit in the frame, which is dropped then
+    size_t write_request(
+        GrowableBuffer& write_buffer,
+        Message::ID id,
+        std::string_view name,
+        const BodyWriter& write,
+        Message::Timeout timeout
+    ) noexcept {
+        size_t body_size = 0;
+        auto timeout_size = timeout ? sizeof(Message::Timeout) : 0;
+        std::span<char> header_buffer;
+        auto it = method_ids.find(name);
+
+        if (version >= 2 && (it != method_ids.end() || name.size() <= message::v2::MAX_NAME_SIZE)) {
+            uint8_t flags = timeout ? message::v2::DEADLINE : 0;
+            Message::MethodID method_id = 0;
+            if (it != method_ids.end()) {
+                flags |= message::v2::INDEXED;
+                method_id = it->second;
+            }
+            header_buffer = message::v2::write_header(write_buffer, id, flags, timeout, name, method_id);
+        } else if (it != method_ids.end()) {
+            auto method_id = it->second;
+            int16_t flag = timeout ? INDEXED_VERIFY_FLAG ^ DEADLINE_FLAG_BIT : INDEXED_VERIFY_FLAG;
+            auto header_size = sizeof(flag) + sizeof(Message::ID) + timeout_size + sizeof(Message::MethodID) + sizeof(size_t);
+            header_buffer = write_buffer.malloc(header_size);
+            auto out = header_buffer.data();
+            out = std::copy((char*)&flag, (char*)&flag+sizeof(flag), out);
+            out = std::copy((char*)&id, (char*)&id+sizeof(Message::ID), out);
+            out = std::copy((char*)&timeout, (char*)&timeout+timeout_size, out);
+            out = std::copy((char*)&method_id, (char*)&method_id+sizeof(Message::MethodID), out);
+            out = std::copy((char*)&body_size, (char*)&body_size+sizeof(size_t), out);
+        } else {
+            int16_t flag = timeout ? VERIFY_FLAG ^ DEADLINE_FLAG_BIT : VERIFY_FLAG;
+            auto header_size = sizeof(flag) + sizeof(Message::ID) + timeout_size + name.size()+1 + sizeof(size_t);
+            header_buffer = write_buffer.malloc(header_size);
+            auto out = header_buffer.data();
+            out = std::copy((char*)&flag, (char*)&flag+sizeof(flag), out);
+            out = std::copy((char*)&id, (char*)&id+sizeof(Message::ID), out);
+            out = std::copy((char*)&timeout, (char*)&timeout+timeout_size, out);
+            out = std::copy(name.begin(), name.end(), out);
+            *out = '\0'; ++out;
+            out = std::copy((char*)&body_size, (char*)&body_size+sizeof(size_t), out);
+        }
+
+        auto size = write_buffer.readable_bytes();
+        write(write_buffer);
+        body_size = write_buffer.readable_bytes() - size;
+        if (!Message::set_body_size(header_buffer, body_size)) {
+            SPDLOG_WARN("drop request {} of {} bytes, too large for its frame", id, body_size);
+            write_buffer.backup(header_buffer.size() + body_size);
+            return 0;
+        }
+        return header_buffer.size();
     }
 
-    Message::ID send_request(std::string_view name, std::string_view body) noexcept {
-        auto id = generate_message_id();
-        auto header_size = sizeof(VERIFY_FLAG) + sizeof(Message::ID) + name.size()+1 + sizeof(size_t);
-        auto body_size = body.size();
+    GrowableBuffer acquire_local_buffer() noexcept {
+        if (local_buffers.empty()) {
+            return {};
+        }
+        auto buffer = std::move(local_buffers.back());
+        local_buffers.pop_back();
+        return buffer;
+    }
 
-        auto header_buffer = write_buffer.malloc(header_size);
-        auto out = header_buffer.data();
-        out = std::copy((char*)&VERIFY_FLAG, ((char*)&VERIFY_FLAG+sizeof(VERIFY_FLAG)), header_buffer.data());
-        out = std::copy((char*)&id, (char*)&id+sizeof(Message::ID), out);
-        out = std::copy(name.begin(), name.end(), out);
-        *out = '\0'; ++out;
-        out = std::copy((char*)&body_size, (char*)&body_size+sizeof(size_t), out);
-        assert(out-header_buffer.data() == header_size);
+    void release_local_buffer(GrowableBuffer&& buffer) noexcept {
+        if (auto n = buffer.readable_bytes(); n) {
+            buffer.read(n);
+        }
+        if (local_buffers.size() < 8) {
+            local_buffers.push_back(std::move(buffer));
+        }
+    }
 
-        if (!body.empty()) write_buffer.write(body);
+    /// the request is framed as usual for the server to parse its arguments
+    /// but never leaves the process, the response frame echoes its header
+    asyncio::Task<Message, RPCError> call_local(std::string_view name, const BodyWriter& write) noexcept {
+        // calls may overlap, each has buffers of its own
+        auto request = acquire_local_buffer();
+        auto out = acquire_local_buffer();
+        auto header_size = write_request(request, 0, name, write, 0);
+        if (header_size == 0) {
+            release_local_buffer(std::move(request));
+            release_local_buffer(std::move(out));
+            co_return RPCError::TooLarge;
+        }
+        auto frame = request.read(request.readable_bytes());
+        // version 2 headers have no trailing size field
+        auto size_pos = message::v2::is_v2(frame) ? header_size : header_size - sizeof(size_t);
+        auto status = co_await local->call(Message({}, frame, size_pos, header_size), out, *local_shard);
+        std::optional<Message> res;
+        if (size_t body_size = out.readable_bytes(); status == LocalStatus::Ok && body_size <= Message::max_body_size(frame)) {
+            auto slab = message::Slab::acquire(header_size + body_size);
+            auto data = slab->data();
+            std::copy(frame.begin(), frame.begin()+header_size, data);
+            Message::set_body_size({ data, header_size }, body_size);
+            if (body_size) {
+                auto body = out.read(body_size);
+                std::copy(body.begin(), body.end(), data+header_size);
+            }
+            res.emplace(std::move(slab), std::string_view(data, header_size+body_size), size_pos, header_size);
+        }
+        release_local_buffer(std::move(request));
+        release_local_buffer(std::move(out));
+        if (status == LocalStatus::NotFound) {
+            co_return RPCError::FunctionNotFound;
+        } else if (status == LocalStatus::BadRequest) {
+            co_return RPCError::BadRequest;
+        } else if (!res) {
+            co_return RPCError::TooLarge;
+        }
+        co_return std::move(*res);
+    }
 
+    asyncio::Task<Message, RPCError> call_remote(
+        std::string_view name,
+        const BodyWriter& write,
+        std::chrono::milliseconds timeout
+    ) noexcept {
+        // negative means none as well, longer ones are clamped
+        auto timeout_ms = (Message::Timeout)std::clamp<std::chrono::milliseconds::rep>(
+            timeout.count(), 0, std::numeric_limits<Message::Timeout>::max()
+        );
+        auto [id, wait] = pending.acquire();
+        if (!send_request(id, name, write, timeout_ms)) {
+            pending.release(id);
+            co_return RPCError::TooLarge;
+        }
+        SPDLOG_DEBUG("wait for message {}", id);
+        std::optional<DeadlineTimer::Token> token;
+        if (timeout_ms) {
+            auto deadline = DeadlineTimer::Clock::now() + timeout;
+            token = timer.schedule(deadline, [this, id] { expire(id); });
+        }
+        // only once write ran, what it refers to may be gone after suspending
+        if (write_queue.congested()) {
+            co_await writable();
+        }
+        auto msg = co_await wait.ev.wait();
+        auto timed_out = wait.timed_out;
+        pending.release(id);
+        if (timed_out) {
+            // let the server stop working on it, no response comes back so the
+            // frame needs no id of its own
+            send_request(0, CANCEL_FUNC, { (const char*)&id, sizeof(id) });
+            co_return RPCError::Timeout;
+        }
+        if (token) {
+            timer.cancel(*token);
+        }
+        if (!msg) {
+            co_return RPCError::ConnectionClosed;
+        }
+        if (msg->overloaded()) {
+            co_return RPCError::Overloaded;
+        } else if (msg->bad_request()) {
+            co_return RPCError::BadRequest;
+        } else if (msg->too_large()) {
+            co_return RPCError::TooLarge;
+        } else if (msg->func_not_found()) {
+            co_return RPCError::FunctionNotFound;
+        } else {
+            co_return std::move(*msg);
+        }
+    }
+
+    /// identical calls of a coalesced function share the request of the
+    /// first, whose response every one of them views
+    asyncio::Task<Message, RPCError> call_coalesced(
+        std::string_view name,
+        const BodyWriter& write,
+        std::chrono::milliseconds timeout
+    ) noexcept {
+        // the body is needed up front to tell identical calls apart
+        GrowableBuffer body;
+        write(body);
+        std::string key(name);
+        key.push_back('\0');
+        key.append(body.read(body.readable_bytes()));
+        // kept across the calls a follower waits for
+        auto deadline = timeout.count() > 0 ? DeadlineTimer::Clock::now() + timeout : DeadlineTimer::Clock::time_point::max();
+        for (auto it = flights.find(key); it != flights.end(); it = flights.find(key)) {
+            auto flight = it->second;
+            // each follower keeps to its own timeout, the request goes on
+            // for the others
+            struct Follow {
+                impl* self;
+                Flight& flight;
+                Follower follower {};
+                std::optional<DeadlineTimer::Token> token { std::nullopt };
+                ~Follow() noexcept {
+                    std::erase(flight.followers, &follower);
+                    if (token) self->timer.cancel(*token);
+                }
+            } follow { this, *flight };
+            flight->followers.push_back(&follow.follower);
+            if (deadline != DeadlineTimer::Clock::time_point::max()) {
+                follow.token = timer.schedule(deadline, [&follower = follow.follower] {
+                    if (!follower.ev.is_set()) {
+                        follower.timed_out = true;
+                        follower.ev.set();
+                    }
+                });
+            }
+            co_await follow.follower.ev.wait();
+            if (follow.follower.timed_out) {
+                co_return RPCError::Timeout;
+            }
+            if (flight->settled) {
+                if (!flight->result) {
+                    co_return flight->result.error();
+                }
+                co_return flight->result->share();
+            }
+            // the first call gave up on its own deadline, the follower
+            // resumed first sends the request again
+        }
+        if (deadline != DeadlineTimer::Clock::time_point::max()) {
+            timeout = std::chrono::ceil<std::chrono::milliseconds>(deadline - DeadlineTimer::Clock::now());
+            if (timeout.count() <= 0) {
+                co_return RPCError::Timeout;
+            }
+        }
+        auto flight = std::make_shared<Flight>();
+        flights.emplace(key, flight);
+        // followers are released even if this call is cancelled
+        struct Land {
+            impl* self;
+            const std::string& key;
+            Flight& flight;
+            ~Land() noexcept {
+                self->flights.erase(key);
+                for (auto follower : flight.followers) {
+                    if (!follower->ev.is_set()) follower->ev.set();
+                }
+            }
+        } land { this, key, *flight };
+        auto request = std::string_view(key).substr(name.size()+1);
+        auto res = co_await call_remote(name, [request](GrowableBuffer& out) {
+            if (!request.empty()) out.write(request);
+        }, timeout);
+        if (res) {
+            flight->result = res->share();
+        } else {
+            flight->result = std::unexpected(res.error());
+        }
+        flight->settled = res || res.error() != RPCError::Timeout;
+        co_return std::move(res);
+    }
+
+    inline void wake_writer() noexcept {
+        if (batches == 0 && !ev.is_set()) {
+            ev.set();
+        }
+    }
+
+    asyncio::Task<> writable() noexcept {
+        // a batch would hold back the very flush waited for
         if (!ev.is_set()) {
             ev.set();
         }
-        return id;
+        co_await write_queue.drained();
+    }
+
+    std::shared_ptr<Stream> open_stream(std::string_view name) noexcept {
+        auto [id, entry] = pending.acquire();
+        std::string header;
+        auto it = method_ids.find(name);
+        if (version >= 2 && (it != method_ids.end() || name.size() <= message::v2::MAX_NAME_SIZE)) {
+            GrowableBuffer buffer;
+            uint8_t flags = message::v2::STREAM;
+            Message::MethodID method_id = 0;
+            if (it != method_ids.end()) {
+                flags |= message::v2::INDEXED;
+                method_id = it->second;
+            }
+            auto view = message::v2::write_header(buffer, id, flags, 0, name, method_id);
+            header.assign(view.data(), view.size());
+        } else {
+            size_t body_size = 0;
+            if (it != method_ids.end()) {
+                int16_t flag = INDEXED_VERIFY_FLAG ^ STREAM_FLAG_BIT;
+                auto method_id = it->second;
+                header.append((char*)&flag, sizeof(flag));
+                header.append((char*)&id, sizeof(id));
+                header.append((char*)&method_id, sizeof(method_id));
+            } else {
+                int16_t flag = VERIFY_FLAG ^ STREAM_FLAG_BIT;
+                header.append((char*)&flag, sizeof(flag));
+                header.append((char*)&id, sizeof(id));
+                header.append(name);
+                header.push_back('\0');
+            }
+            header.append((char*)&body_size, sizeof(body_size));
+        }
+        auto stream = std::make_shared<Stream>(
+            header,
+            write_queue,
+            [this] { wake_writer(); },
+            backlog,
+            options.max_stream_buffered
+        );
+        entry.stream = stream;
+        // whichever end finishes last, or dropping the stream, frees the slot
+        stream->on_done([this, id] { pending.release(id); });
+        return stream;
+    }
+
+    void expire(Message::ID id) noexcept {
+        if (auto entry = pending.find(id); entry && !entry->ev.is_set()) {
+            SPDLOG_DEBUG("message {} timed out", id);
+            entry->timed_out = true;
+            entry->ev.set();
+        }
     }
 };
 
@@ -164,29 +558,121 @@ Client& Client::operator=(Client&& c) noexcept {
     return *this;
 }
 
+void Client::set_options(const ConnectionOptions& options) noexcept {
+    _pimpl->options = options;
+}
+
 asyncio::Task<bool> Client::connect(const char* host, short port) noexcept{
-    return _pimpl->connect(host, port);
+    if (!co_await _pimpl->connect(host, port)) {
+        co_return false;
+    }
+    if (auto wanted = _pimpl->options.frame_version; wanted > 1) {
+        // servers predating PROTOCOL_FUNC answer FunctionNotFound, which
+        // keeps version 1
+        auto res = co_await call(PROTOCOL_FUNC, { (const char*)&wanted, sizeof(wanted) });
+        if (res && !res->body().empty()) {
+            _pimpl->version = std::min<uint8_t>(res->body()[0], wanted);
+            SPDLOG_INFO("speaking frame version {}", _pimpl->version);
+        }
+    }
+    co_return true;
+}
+
+void Client::connect(LocalEndpoint& server) noexcept {
+    _pimpl->disconnect();
+    _pimpl->method_ids.clear();
+    _pimpl->local = &server;
+    _pimpl->local_shard = &server.local_shard();
+    // the server is built from the same sources
+    _pimpl->version = std::clamp<uint8_t>(_pimpl->options.frame_version, 1, FRAME_VERSION);
+    SPDLOG_INFO("successfully connect in process");
+}
+
+const DispatchTable::Entry* Client::find_direct(std::string_view name, const std::type_info& signature) const noexcept {
+    return _pimpl->local ? _pimpl->local->find_direct(name, signature) : nullptr;
 }
 
-asyncio::Task<Message, RPCError> Client::call(std::string_view name, std::string_view data) noexcept {
+asyncio::Task<> Client::call_direct(const DispatchTable::Entry& method, DirectCall call) noexcept {
+    return _pimpl->local->call_direct(method, call, *_pimpl->local_shard);
+}
+
+asyncio::Task<Message, RPCError> Client::call(
+    std::string_view name,
+    std::string_view data,
+    std::chrono::milliseconds timeout
+) noexcept {
+    return call(name, [data](GrowableBuffer& out) {
+        if (!data.empty()) out.write(data);
+    }, timeout);
+}
+
+asyncio::Task<Message, RPCError> Client::call(
+    std::string_view name,
+    BodyWriter write,
+    std::chrono::milliseconds timeout
+) noexcept {
+    if (_pimpl->local) {
+        co_return co_await _pimpl->call_local(name, write);
+    }
     if (!_pimpl->write_task) {
         co_return RPCError::ConnectionClosed;
     }
-    auto id = _pimpl->send_request(name, data);
-    SPDLOG_DEBUG("wait for message {}", id);
-    auto [pair, success] = _pimpl->waits.insert({ id, {} });
-    assert(success && "id conflict");
-    auto& [_, ev] = *pair;
-    auto msg = co_await ev.wait();
-    _pimpl->waits.erase(id);
-    if (!msg) {
-        co_return RPCError::ConnectionClosed;
+    if (_pimpl->coalesced.contains(name)) {
+        co_return co_await _pimpl->call_coalesced(name, write, timeout);
+    }
+    co_return co_await _pimpl->call_remote(name, write, timeout);
+}
+
+std::shared_ptr<Stream> Client::open_stream(std::string_view name) noexcept {
+    if (!_pimpl->write_task) {
+        return nullptr;
+    }
+    return _pimpl->open_stream(name);
+}
+
+Client::Batch Client::batch() noexcept {
+    return Batch(_pimpl);
+}
+
+void Client::coalesce(std::string_view name) noexcept {
+    _pimpl->coalesced.emplace(name);
+}
+
+Client::Batch::Batch(impl* client) noexcept: _client(client) {
+    ++_client->batches;
+}
+
+Client::Batch::Batch(Batch&& batch) noexcept: _client(std::exchange(batch._client, nullptr)) {}
+
+Client::Batch::~Batch() noexcept {
+    submit();
+}
+
+void Client::Batch::submit() noexcept {
+    if (auto client = std::exchange(_client, nullptr); client) {
+        --client->batches;
+        client->wake_writer();
+    }
+}
+
+asyncio::Task<bool> Client::fetch_method_table() noexcept {
+    auto res = co_await call(METHOD_TABLE_FUNC, {});
+    if (!res) {
+        co_return false;
     }
-    if (msg->func_name().empty()) {
-        co_return RPCError::FunctionNotFound;
-    } else {
-        co_return std::move(*msg);
+    auto names = res->body();
+    Message::MethodID method_id = 0;
+    _pimpl->method_ids.clear();
+    while (!names.empty()) {
+        auto n = names.find('\0');
+        if (n == names.npos) {
+            break;
+        }
+        _pimpl->method_ids.emplace(names.substr(0, n), method_id++);
+        names.remove_prefix(n+1);
     }
+    SPDLOG_INFO("fetched {} functions from server", method_id);
+    co_return true;
 }
 
 TINYRPC_NS_END
@@ -0,0 +1,77 @@
+#include <cstring>
+
+#include <sys/timerfd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "tinyrpc/deadline_timer.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+DeadlineTimer::~DeadlineTimer() noexcept {
+    if (_task) {
+        _task->cancel();
+    }
+}
+
+DeadlineTimer::Token DeadlineTimer::schedule(Clock::time_point deadline, Callback&& callback) noexcept {
+    if (!_task) {
+        // steady_clock is CLOCK_MONOTONIC, so deadlines arm it as they are
+        _fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (_fd == -1) {
+            std::perror("failed to create timerfd");
+            exit(EXIT_FAILURE);
+        }
+        _task = fire_forever();
+    }
+    Token token { deadline, _seq++ };
+    auto earliest = _callbacks.empty() || token < _callbacks.begin()->first;
+    _callbacks.emplace(token, std::move(callback));
+    if (earliest) {
+        arm();
+    }
+    return token;
+}
+
+void DeadlineTimer::cancel(const Token& token) noexcept {
+    // the timer stays armed, waking up early once is cheaper than rearming
+    _callbacks.erase(token);
+}
+
+void DeadlineTimer::arm() noexcept {
+    itimerspec spec {};
+    if (!_callbacks.empty()) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            _callbacks.begin()->first.first.time_since_epoch()
+        ).count();
+        // zero would disarm the timer
+        ns = std::max<decltype(ns)>(ns, 1);
+        spec.it_value.tv_sec = ns / 1'000'000'000;
+        spec.it_value.tv_nsec = ns % 1'000'000'000;
+    }
+    if (timerfd_settime(_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+        SPDLOG_ERROR("failed to arm timerfd {}: {}", _fd, std::strerror(errno));
+    }
+}
+
+asyncio::Task<> DeadlineTimer::fire_forever() noexcept {
+    // the socket owns the timerfd from here on
+    asyncio::Socket sock(_fd);
+    uint64_t expirations;
+    while (true) {
+        auto res = co_await sock.read((char*)&expirations, sizeof(expirations));
+        if (!res) {
+            SPDLOG_ERROR("error while read from timerfd {}: {}", _fd, res.error());
+            break;
+        }
+        auto now = Clock::now();
+        while (!_callbacks.empty() && _callbacks.begin()->first.first <= now) {
+            auto node = _callbacks.extract(_callbacks.begin());
+            node.mapped()();
+        }
+        arm();
+    }
+}
+
+TINYRPC_NS_END
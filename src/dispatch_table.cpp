@@ -0,0 +1,72 @@
+#include "tinyrpc/dispatch_table.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+static inline size_t hash_name(std::string_view name) noexcept {
+    return std::hash<std::string_view>{}(name);
+}
+
+size_t DispatchTable::probe(std::string_view name, size_t hash) const noexcept {
+    auto mask = _slots.size()-1;
+    for (auto i = hash & mask;; i = (i+1) & mask) {
+        auto& slot = _slots[i];
+        if (slot.id == Message::invalid_method
+            || (slot.hash == hash && _entries[slot.id].name == name)) {
+            return i;
+        }
+    }
+}
+
+void DispatchTable::rehash(size_t capacity) noexcept {
+    _slots.assign(capacity, {});
+    auto mask = capacity-1;
+    for (Message::MethodID id = 0; id < _entries.size(); ++id) {
+        auto hash = hash_name(_entries[id].name);
+        auto i = hash & mask;
+        while (_slots[i].id != Message::invalid_method) {
+            i = (i+1) & mask;
+        }
+        _slots[i] = { hash, id };
+    }
+}
+
+bool DispatchTable::add(std::string_view name, Handler&& handler, Execution execution, CachePolicy cache) noexcept {
+    if (_frozen) {
+        return false;
+    }
+    if ((_entries.size()+1)*2 > _slots.size()) {
+        rehash(std::max<size_t>(16, _slots.size()*2));
+    }
+    auto hash = hash_name(name);
+    auto& slot = _slots[probe(name, hash)];
+    if (slot.id != Message::invalid_method) {
+        _entries[slot.id].handler = std::move(handler);
+        _entries[slot.id].execution = execution;
+        _entries[slot.id].cache = cache;
+        return true;
+    }
+    auto id = (Message::MethodID)_entries.size();
+    slot = { hash, id };
+    _entries.emplace_back(std::string(name), std::move(handler), execution, id, cache);
+    return true;
+}
+
+bool DispatchTable::limit(std::string_view name, size_t max_running) noexcept {
+    auto entry = find(name);
+    if (_frozen || !entry) {
+        return false;
+    }
+    _entries[entry->id].max_running = max_running;
+    return true;
+}
+
+const DispatchTable::Entry* DispatchTable::find(std::string_view name) const noexcept {
+    if (_slots.empty()) {
+        return nullptr;
+    }
+    auto& slot = _slots[probe(name, hash_name(name))];
+    return slot.id == Message::invalid_method ? nullptr : &_entries[slot.id];
+}
+
+TINYRPC_NS_END
@@ -1,9 +1,14 @@
+#include <cstring>
 #include <utility>
 
+#include <sys/socket.h>
+
 #include <spdlog/spdlog.h>
+#include <spdlog/fmt/bin_to_hex.h>
 
 #include "tinyrpc/message/parser.hpp"
 #include "tinyrpc/message.hpp"
+#include "tinyrpc/message/recv_sizer.hpp"
 #include "tinyrpc/utils.hpp"
 #include "tinyrpc_config.hpp"
 
@@ -13,101 +18,287 @@ TINYRPC_NS_BEGIN(message)
 struct Parser::impl {
     enum class State {
         Verify,
+        Header,
         ID,
         Name,
         Size,
         Body,
+        // a frame was too large, its end is unknown so nothing can follow
+        Broken,
     };
     State state { State::Verify };
-    std::string flag_buffer {};
-    Message msg {};
+    Slab::Ref slab {};
+    // [begin, end) of slab holds received but not yet consumed bytes,
+    // begin is the start of the current frame once verified
+    size_t begin { 0 };
+    size_t end { 0 };
+    // how far the name terminator search got
+    size_t cursor { 0 };
+    // offsets relative to begin
+    size_t method_pos { 0 };
+    size_t size_pos { 0 };
+    size_t body_pos { 0 };
+    size_t frame_size { 0 };
     std::vector<Message> msgs {};
+    RecvSizer sizer { TINYRPC_DEFAULT_BUFFER_SIZE, TINYRPC_MAX_RECV_SIZE };
+    size_t max_frame_size { TINYRPC_MAX_FRAME_SIZE };
+
+    inline const char* frame() noexcept {
+        return slab->data()+begin;
+    }
 
-    inline int16_t flag() const noexcept {
-        return *(int16_t*)flag_buffer.data();
+    /// search [begin, end) for VERIFY_FLAG or INDEXED_VERIFY_FLAG, with any
+    /// of FLAG_MODIFIER_BITS, or the start of a version 2 header and move
+    /// begin to it. memchr is vectorized by libc, so resyncing on garbage
+    /// costs about a memory scan.
+    bool find_flag() noexcept {
+        static_assert(sizeof(VERIFY_FLAG) == 2);
+        auto flag = (const char*)&VERIFY_FLAG;
+        auto indexed_flag = (const char*)&INDEXED_VERIFY_FLAG;
+        auto modifiers = ((const char*)&FLAG_MODIFIER_BITS)[1];
+        auto data = slab->data();
+        while (begin < end) {
+            auto p = (const char*)std::memchr(data+begin, flag[0], end-begin);
+            if (!p) {
+                begin = end;
+                break;
+            }
+            begin = p-data;
+            if (begin+1 == end) {
+                // keep the first flag byte until the next read
+                break;
+            }
+            auto second = p[1] & ~modifiers;
+            if (second == (flag[1] & ~modifiers)
+                || second == (indexed_flag[1] & ~modifiers)
+                || (uint8_t)p[1] == v2::VERSION) {
+                return true;
+            }
+            ++begin;
+        }
+        return false;
     }
 
-    inline bool fill_flag(char c) noexcept {
-        flag_buffer.push_back(c);
-        return flag_buffer.size() == sizeof(VERIFY_FLAG);
+    /// sizes come from the peer, checked such that neither overflows
+    bool fits(size_t body_pos, size_t body_size) noexcept {
+        if (body_pos <= max_frame_size && body_size <= max_frame_size-body_pos) {
+            return true;
+        }
+        SPDLOG_ERROR("frame of {}+{} bytes exceeds the maximum of {}", body_pos, body_size, max_frame_size);
+        state = State::Broken;
+        return false;
     }
 
     void trigger_handle() noexcept {
-        msgs.push_back(std::exchange(msg, {}));
+        msgs.emplace_back(slab, std::string_view(frame(), frame_size), size_pos, body_pos);
         SPDLOG_DEBUG("successfully handle message");
-        flag_buffer.clear();
+        begin += frame_size;
         state = State::Verify;
     }
 
-    std::vector<Message> process(const char* data, size_t size) noexcept {
-        int pos = 0;
-        while (pos < size) {
+    void parse() noexcept {
+        while (begin < end && state != State::Broken) {
+            auto available = end-begin;
             switch (state) {
                 case State::Verify: {
-                    for (; pos < size; ++pos) {
-                        if (fill_flag(data[pos])) {
-                            if (flag() == VERIFY_FLAG) {
-                                state = State::ID;
-                                SPDLOG_DEBUG("verify successfully");
-                            } else {
-                                flag_buffer.clear();
-                                SPDLOG_DEBUG("failed to verify");
-                            }
-                            break;
-                        }
+                    if (!find_flag()) {
+                        SPDLOG_DEBUG("failed to verify");
+                        return;
                     }
+                    state = (uint8_t)frame()[1] == v2::VERSION ? State::Header : State::ID;
+                    SPDLOG_DEBUG("verify successfully");
+                    break;
+                }
+                case State::Header: {
+                    // the fixed part tells the size of the whole frame
+                    if (available < v2::HEADER_SIZE) {
+                        return;
+                    }
+                    std::string_view header(frame(), v2::HEADER_SIZE);
+                    body_pos = v2::header_size(header);
+                    size_pos = body_pos;
+                    auto body_size = v2::load<uint32_t>(frame()+v2::BODY_SIZE_POS);
+                    if (!fits(body_pos, body_size)) {
+                        return;
+                    }
+                    frame_size = body_pos + body_size;
+                    state = State::Body;
+                    SPDLOG_DEBUG("ID: {}, body size: {}", Message::id(header), frame_size-body_pos);
                     break;
                 }
                 case State::ID: {
-                    for (; pos < size; ++pos) {
-                        if (msg.fill_id(data[pos])) {
-                            state = State::Name;
-                            SPDLOG_DEBUG("ID: {}", msg.id());
-                            break;
-                        }
+                    auto flag = *(int16_t*)frame();
+                    method_pos = Message::method_pos(flag);
+                    if (available < method_pos) {
+                        return;
+                    }
+                    SPDLOG_DEBUG("ID: {}", *(Message::ID*)(frame()+sizeof(VERIFY_FLAG)));
+                    if (Message::indexed(flag)) {
+                        size_pos = method_pos+sizeof(Message::MethodID);
+                        state = State::Size;
+                        break;
                     }
+                    cursor = method_pos;
+                    state = State::Name;
                     break;
                 }
                 case State::Name: {
-                    for (; pos < size; ++pos) {
-                        if (msg.fill_func_name(data[pos])) {
-                            if (msg.func_name().empty()) {
-                                SPDLOG_DEBUG("empty function name");
-                                trigger_handle();
-                                break;
-                            }
-                            state = State::Size;
-                            SPDLOG_DEBUG("function name: {}", msg.func_name());
-                            break;
-                        }
+                    auto p = (const char*)std::memchr(frame()+cursor, '\0', available-cursor);
+                    if (!p) {
+                        cursor = available;
+                        fits(cursor, 0);
+                        return;
+                    }
+                    size_pos = p+1-frame();
+                    if (size_pos == method_pos+1) {
+                        SPDLOG_DEBUG("empty function name");
+                        body_pos = size_pos;
+                        frame_size = size_pos;
+                        trigger_handle();
+                        break;
                     }
+                    state = State::Size;
+                    SPDLOG_DEBUG("function name: {}", std::string_view(frame()+method_pos, p));
                     break;
                 }
                 case State::Size: {
-                    for (; pos < size; ++pos) {
-                        if (msg.fill_body_size(data[pos])) {
-                            state = State::Body;
-                            SPDLOG_DEBUG("body size: {}", msg.body_size());
-                            if (msg.body_size() == 0) {
-                                trigger_handle();
-                            }
-                            break;
-                        }
+                    if (available < size_pos+sizeof(size_t)) {
+                        return;
                     }
+                    body_pos = size_pos+sizeof(size_t);
+                    auto body_size = *(size_t*)(frame()+size_pos);
+                    if (!fits(body_pos, body_size)) {
+                        return;
+                    }
+                    frame_size = body_pos+body_size;
+                    state = State::Body;
+                    SPDLOG_DEBUG("body size: {}", body_size);
                     break;
                 }
                 case State::Body: {
-                    for (; pos < size; ++pos) {
-                        if (msg.fill_body(data[pos])) {
-                            SPDLOG_DEBUG("successfully load message body");
-                            trigger_handle();
-                            break;
-                        }
+                    if (available < frame_size) {
+                        return;
                     }
+                    SPDLOG_DEBUG("successfully load message body");
+                    trigger_handle();
+                    break;
+                }
+                case State::Broken: {
+                    return;
+                }
+            }
+        }
+    }
+
+    std::span<char> prepare(size_t min_size) noexcept {
+        // bytes the current frame still needs, once its size is known. The
+        // size is only claimed by the peer, so no more than what arrived so
+        // far or a full read is reserved ahead, the slab grows as bytes come
+        auto pending = end-begin;
+        if (state == State::Body && frame_size > pending) {
+            min_size = std::max(min_size, std::min(frame_size-pending, std::max(pending, sizer.max())));
+        }
+        if (slab && begin > 0 && slab->unique() && slab->capacity()-end < min_size) {
+            // nobody views into the slab anymore, reuse it from the start
+            std::memmove(slab->data(), slab->data()+begin, pending);
+            begin = 0;
+            end = pending;
+        }
+        if (!slab || slab->capacity()-end < min_size) {
+            // the current frame does not fit, move it to a fresh slab
+            auto new_slab = Slab::acquire(pending+min_size);
+            if (pending > 0) {
+                std::memcpy(new_slab->data(), slab->data()+begin, pending);
+            }
+            slab = std::move(new_slab);
+            begin = 0;
+            end = pending;
+        }
+        return { slab->data()+end, slab->capacity()-end };
+    }
+
+    /// drop an oversized slab nothing is pending in, so that idle
+    /// connections hand big buffers back to the pool
+    void shrink(size_t size) noexcept {
+        if (slab && begin == end && slab->capacity() > 2*size) {
+            slab.reset();
+            begin = end = 0;
+        }
+    }
+
+    inline void append(std::vector<Message>& out) noexcept {
+        if (out.empty()) {
+            out = std::exchange(msgs, {});
+        } else {
+            std::move(msgs.begin(), msgs.end(), std::back_inserter(out));
+            msgs.clear();
+        }
+    }
+
+    asyncio::Task<bool> read(asyncio::Socket& sock, std::vector<Message>& out) noexcept {
+        // wait for data with a small buffer, then drain with the adaptive size
+        shrink(sizer.min());
+        auto buffer = prepare(sizer.min());
+        auto res = co_await sock.read(buffer.data(), buffer.size());
+        if (!res) {
+            SPDLOG_ERROR("error while read from fd {}: {}", sock.fd(), res.error());
+            co_return false;
+        }
+        size_t nbytes = *res;
+        while (true) {
+            if (nbytes == 0) {
+                SPDLOG_INFO("connection closed by peer, fd {}", sock.fd());
+                co_return false;
+            }
+            SPDLOG_DEBUG(
+                "recv {} bytes data:{}",
+                nbytes,
+                spdlog::to_hex(buffer.first(nbytes))
+            );
+            sizer.record(buffer.size(), nbytes);
+            end += nbytes;
+            parse();
+            append(out);
+            if (state == State::Broken) {
+                SPDLOG_ERROR("close fd {} sending an oversized frame", sock.fd());
+                co_return false;
+            }
+            if (nbytes < buffer.size()) {
+                // a short read means the socket buffer is empty
+                break;
+            }
+            buffer = prepare(sizer.next());
+            ssize_t n;
+            do {
+                n = ::recv(sock.fd(), buffer.data(), buffer.size(), MSG_DONTWAIT);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
                     break;
                 }
+                SPDLOG_ERROR("error while read from fd {}: {}", sock.fd(), std::strerror(errno));
+                co_return false;
             }
-            ++pos;
+            nbytes = n;
+        }
+        co_return true;
+    }
+
+    std::vector<Message> commit(size_t nbytes) noexcept {
+        end += nbytes;
+        parse();
+        return std::exchange(msgs, {});
+    }
+
+    std::vector<Message> process(const char* data, size_t size) noexcept {
+        while (size > 0) {
+            auto buffer = prepare(std::min(size, TINYRPC_DEFAULT_BUFFER_SIZE));
+            auto n = std::min(size, buffer.size());
+            std::memcpy(buffer.data(), data, n);
+            data += n;
+            size -= n;
+            end += n;
+            parse();
         }
         return std::exchange(msgs, {});
     }
@@ -131,6 +322,30 @@ Parser& Parser::operator=(Parser&& p) noexcept {
     return *this;
 }
 
+void Parser::set_recv_size(size_t min, size_t max) noexcept {
+    _pimpl->sizer = RecvSizer(min, max);
+}
+
+void Parser::set_max_frame_size(size_t size) noexcept {
+    _pimpl->max_frame_size = size;
+}
+
+bool Parser::broken() const noexcept {
+    return _pimpl->state == impl::State::Broken;
+}
+
+asyncio::Task<bool> Parser::read(asyncio::Socket& sock, std::vector<Message>& msgs) noexcept {
+    return _pimpl->read(sock, msgs);
+}
+
+std::span<char> Parser::prepare(size_t min_size) noexcept {
+    return _pimpl->prepare(min_size);
+}
+
+std::vector<Message> Parser::commit(size_t nbytes) noexcept {
+    return _pimpl->commit(nbytes);
+}
+
 std::vector<Message> Parser::process(const char* data, size_t size) noexcept {
     return _pimpl->process(data, size);
 }
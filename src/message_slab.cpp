@@ -0,0 +1,75 @@
+#include <array>
+#include <bit>
+#include <new>
+#include <vector>
+
+#include "tinyrpc/message/slab.hpp"
+
+
+TINYRPC_NS_BEGIN(message)
+
+namespace {
+
+// slabs come in power of two size classes, bigger ones are not pooled
+constexpr size_t min_slab_shift = 10;
+constexpr size_t max_slab_shift = 20;
+// bytes each size class may keep around per thread
+constexpr size_t max_pooled_bytes = 256 * 1024;
+
+struct SlabPool {
+    std::array<std::vector<void*>, max_slab_shift-min_slab_shift+1> free_slabs {};
+
+    ~SlabPool() noexcept {
+        for (auto& slabs : free_slabs) {
+            for (auto p : slabs) {
+                ::operator delete(p);
+            }
+        }
+    }
+
+    static inline size_t class_of(size_t capacity) noexcept {
+        capacity = std::max<size_t>(capacity, 1);
+        return std::max((size_t)std::bit_width(capacity-1), min_slab_shift)-min_slab_shift;
+    }
+
+    static inline size_t max_free_slabs(size_t cls) noexcept {
+        return std::max<size_t>(1, max_pooled_bytes >> (cls+min_slab_shift));
+    }
+};
+
+thread_local SlabPool pool;
+
+}
+
+
+Slab::Ref Slab::acquire(size_t capacity) noexcept {
+    if (capacity <= (1 << max_slab_shift)) {
+        auto cls = SlabPool::class_of(capacity);
+        capacity = 1 << (cls+min_slab_shift);
+        if (auto& slabs = pool.free_slabs[cls]; !slabs.empty()) {
+            auto p = slabs.back();
+            slabs.pop_back();
+            return Ref(new (p) Slab(capacity));
+        }
+    }
+    auto p = ::operator new(sizeof(Slab)+capacity);
+    return Ref(new (p) Slab(capacity));
+}
+
+void Slab::release(Slab* slab) noexcept {
+    if (slab->_refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    auto capacity = slab->_capacity;
+    slab->~Slab();
+    if (capacity <= (1 << max_slab_shift)) {
+        auto cls = SlabPool::class_of(capacity);
+        if (auto& slabs = pool.free_slabs[cls]; slabs.size() < SlabPool::max_free_slabs(cls)) {
+            slabs.push_back(slab);
+            return;
+        }
+    }
+    ::operator delete(slab);
+}
+
+TINYRPC_NS_END
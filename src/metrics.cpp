@@ -0,0 +1,71 @@
+#include "tinyrpc/metrics.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+static inline uint64_t load(const MetricsShard::Counter& counter) noexcept {
+    return counter.load(std::memory_order_relaxed);
+}
+
+static void merge(std::vector<uint64_t>& out, const MetricsShard::Histogram& histogram) noexcept {
+    auto& buckets = histogram.buckets;
+    auto used = buckets.size();
+    while (used > 0 && load(buckets[used-1]) == 0) {
+        --used;
+    }
+    if (out.size() < used) {
+        out.resize(used);
+    }
+    for (size_t i = 0; i < used; ++i) {
+        out[i] += load(buckets[i]);
+    }
+}
+
+MetricsShard::ConnectionHandle MetricsShard::open(int fd) noexcept {
+    std::lock_guard lock(_mutex);
+    return _connections.emplace(_connections.end(), fd);
+}
+
+void MetricsShard::close(ConnectionHandle conn) noexcept {
+    std::lock_guard lock(_mutex);
+    _connections.erase(conn);
+}
+
+void MetricsShard::collect(ServerStats& stats) noexcept {
+    for (size_t id = 0; id < _methods.size() && id < stats.methods.size(); ++id) {
+        auto& method = _methods[id];
+        auto& out = stats.methods[id];
+        out.calls += load(method.calls);
+        out.errors += load(method.errors);
+        out.bytes_in += load(method.bytes_in);
+        out.bytes_out += load(method.bytes_out);
+        out.cache_hits += load(method.cache_hits);
+        out.shed += load(method.shed);
+        merge(out.queue_time, method.queue_time);
+        merge(out.handler_time, method.handler_time);
+    }
+    stats.not_found += load(_not_found);
+    std::lock_guard lock(_mutex);
+    for (auto& conn : _connections) {
+        stats.connections.push_back({ conn.fd, load(conn.write_queued), load(conn.inflight) });
+    }
+}
+
+MetricsShard& Metrics::add_shard(size_t methods) noexcept {
+    std::lock_guard lock(_mutex);
+    return _shards.emplace_back(methods);
+}
+
+ServerStats Metrics::snapshot(const DispatchTable& table) noexcept {
+    ServerStats stats;
+    for (auto& entry : table.entries()) {
+        stats.methods.push_back({ .name = entry.name });
+    }
+    std::lock_guard lock(_mutex);
+    for (auto& shard : _shards) {
+        shard.collect(stats);
+    }
+    return stats;
+}
+
+TINYRPC_NS_END
@@ -0,0 +1,109 @@
+#include "tinyrpc/response_cache.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+static inline uint64_t hash_key(Message::MethodID method, std::string_view request) noexcept {
+    return std::hash<std::string_view>{}(request) ^ ((uint64_t)method * 0x9e3779b97f4a7c15);
+}
+
+std::optional<std::string_view> ResponseCache::find(
+    Message::MethodID method,
+    std::string_view request,
+    Clock::time_point now
+) noexcept {
+    if (_index.empty()) {
+        return std::nullopt;
+    }
+    auto it = _index.find(hash_key(method, request));
+    if (it == _index.end()) {
+        return std::nullopt;
+    }
+    auto& slot = _slots[it->second];
+    if (slot.method != method || slot.request != request) {
+        return std::nullopt;
+    }
+    if (slot.expires <= now) {
+        evict(it->second);
+        return std::nullopt;
+    }
+    slot.referenced = true;
+    return slot.response;
+}
+
+void ResponseCache::insert(
+    Message::MethodID method,
+    std::string&& request,
+    std::string_view response,
+    Clock::time_point expires
+) noexcept {
+    // moved into the slot as they are, so their cost does not change
+    std::string body(response);
+    auto cost = Slot::cost(request, body);
+    // one response would push out everything else
+    if (cost > _budget / 4) {
+        return;
+    }
+    auto hash = hash_key(method, request);
+    if (auto it = _index.find(hash); it != _index.end()) {
+        evict(it->second);
+    }
+    auto now = Clock::now();
+    while (_bytes + cost > _budget) {
+        evict_one(now);
+    }
+    uint32_t i;
+    if (_free.empty()) {
+        i = _slots.size();
+        _slots.emplace_back();
+    } else {
+        i = _free.back();
+        _free.pop_back();
+    }
+    auto& slot = _slots[i];
+    slot.hash = hash;
+    slot.method = method;
+    slot.used = true;
+    // admitted unreferenced, a key hit once is the first to go
+    slot.referenced = false;
+    slot.expires = expires;
+    slot.request = std::move(request);
+    slot.response = std::move(body);
+    // the same helper evict subtracts, taken from the stored strings
+    _bytes += slot.cost();
+    _index.emplace(hash, i);
+}
+
+void ResponseCache::evict(uint32_t i) noexcept {
+    auto& slot = _slots[i];
+    _bytes -= slot.cost();
+    _index.erase(slot.hash);
+    slot.used = false;
+    // released, a free slot holding on to its capacity would be memory the
+    // budget no longer counts
+    std::string().swap(slot.request);
+    std::string().swap(slot.response);
+    _free.push_back(i);
+}
+
+void ResponseCache::evict_one(Clock::time_point now) noexcept {
+    // at most two rounds, the first clears every referenced bit
+    while (true) {
+        if (_hand >= _slots.size()) {
+            _hand = 0;
+        }
+        auto i = _hand++;
+        auto& slot = _slots[i];
+        if (!slot.used) {
+            continue;
+        }
+        if (slot.referenced && slot.expires > now) {
+            slot.referenced = false;
+            continue;
+        }
+        evict(i);
+        return;
+    }
+}
+
+TINYRPC_NS_END
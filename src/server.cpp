@@ -1,124 +1,689 @@
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
 #include <spdlog/spdlog.h>
-#include <spdlog/fmt/bin_to_hex.h>
 
 #include <growable_buffer.hpp>
 
+#include "tinyrpc.hpp"
 #include "tinyrpc/utils.hpp"
 #include "tinyrpc/server.hpp"
+#include "tinyrpc/dispatch_table.hpp"
+#include "tinyrpc/admission.hpp"
+#include "tinyrpc/metrics.hpp"
+#include "tinyrpc/response_cache.hpp"
+#include "tinyrpc/stream.hpp"
+#include "tinyrpc/thread_pool.hpp"
+#include "tinyrpc/unix_socket.hpp"
+#include "tinyrpc/write_queue.hpp"
 #include "tinyrpc/message/parser.hpp"
 
 
 TINYRPC_NS_BEGIN()
 
-struct Server::impl {
+struct Server::impl final: LocalEndpoint {
     asyncio::Socket sock {};
-    std::unordered_map<std::string, Function> funcs {};
-    std::unordered_map<std::string, AFunction> afuncs {};
+    std::string host {};
+    short port { 0 };
+    int max_listen_num { 0 };
+    ConnectionOptions options {};
+    DispatchTable table {};
+    size_t thread_pool_size { TINYRPC_THREAD_POOL_SIZE };
+    size_t response_cache_size { TINYRPC_RESPONSE_CACHE_SIZE };
+    AdmissionOptions admission_options {};
+    std::unique_ptr<ThreadPool> workers { nullptr };
+    Metrics metrics {};
+    // shards of the threads calling in process, keyed by thread
+    std::mutex local_mutex {};
+    std::unordered_map<std::thread::id, MetricsShard*> local_shards {};
+    // local() may be taken by several clients, from several threads
+    std::once_flag started {};
+
+    impl() noexcept {
+        register_handler(std::string(METHOD_TABLE_FUNC), Handler::sync([this](Message&&, GrowableBuffer& out) {
+            for (auto& entry : table.entries()) {
+                out.write(entry.name);
+                out.write('\0');
+            }
+        }));
+        // requests of every version are understood anyway, the answer only
+        // tells the caller which it may send
+        register_handler(std::string(PROTOCOL_FUNC), Handler::sync([this](Message&& msg, GrowableBuffer& out) {
+            auto body = msg.body();
+            auto highest = std::clamp<uint8_t>(options.frame_version, 1, FRAME_VERSION);
+            auto version = body.empty() ? 1 : std::clamp<uint8_t>(body[0], 1, highest);
+            out.write((char)version);
+        }));
+    }
 
-    inline void register_func(const std::string& name, Function&& func) noexcept {
-        if (funcs.contains(name)) {
+    inline void register_handler(
+        const std::string& name,
+        Handler&& handler,
+        Execution execution = Execution::Inline,
+        CachePolicy cache = {}
+    ) noexcept {
+        if (table.frozen()) {
+            SPDLOG_WARN("server is running, ignore registration of function {}", name);
+            return;
+        }
+        if (execution == Execution::WorkerPool && (handler.is_async() || handler.is_stream())) {
+            SPDLOG_WARN("async function {} always runs on the event loop", name);
+            execution = Execution::Inline;
+        }
+        if (cache.enabled() && handler.is_stream()) {
+            SPDLOG_WARN("responses of stream function {} are not cached", name);
+            cache = {};
+        }
+        if (table.find(name)) {
             SPDLOG_INFO("update function {}", name);
         } else {
             SPDLOG_INFO("register function {}", name);
         }
-        funcs[name] = std::move(func);
+        table.add(name, std::move(handler), execution, cache);
     }
 
-    inline void register_afunc(const std::string& name, AFunction&& afunc) noexcept {
-        if (afuncs.contains(name)) {
-            SPDLOG_INFO("update async function {}", name);
-        } else {
-            SPDLOG_INFO("register async function {}", name);
-        }
-        afuncs[name] = std::move(afunc);
+    inline const DispatchTable::Entry* find_method(const Message& msg) const noexcept {
+        return msg.indexed() ? table.find(msg.method_id()) : table.find(msg.func_name());
     }
 
     asyncio::Task<> write_forever(
         asyncio::Socket& sock,
         asyncio::Event<bool>& ev,
-        GrowableBuffer& buffer
+        WriteQueue& write_queue,
+        MetricsShard::Connection& gauges
     ) noexcept {
         SPDLOG_INFO("start write task for fd {}", sock.fd());
-        char temp_buffer[TINYRPC_DEFAULT_BUFFER_SIZE];
         while (true) {
-            if (buffer.readable_bytes() == 0) {
+            if (write_queue.empty()) {
                 auto stop = co_await ev.wait();
                 if (stop && *stop) {
                     break;
                 }
             }
-            auto nbytes = std::min(buffer.readable_bytes(), TINYRPC_DEFAULT_BUFFER_SIZE);
-            auto view = buffer.read(nbytes);
-            std::copy(view.begin(), view.end(), temp_buffer);
-            auto res = co_await sock.write(temp_buffer, nbytes);
-            if (!res) {
-                SPDLOG_ERROR("error while write to fd {}: {}", sock.fd(), res.error());
-                continue;
-            }
-            SPDLOG_DEBUG(
-                "write {} bytes data to fd {}:{}",
-                nbytes,
-                sock.fd(),
-                spdlog::to_hex(std::span(temp_buffer, nbytes))
-            );
+            if (!co_await write_queue.flush(sock)) {
+                write_queue.clear();
+            }
+            MetricsShard::set(gauges.write_queued, write_queue.size());
         }
         SPDLOG_INFO("stop write task for fd {}", sock.fd());
     }
 
-    asyncio::Task<> handle_message(Message msg, GrowableBuffer& write_buffer, asyncio::Event<bool>& ev) noexcept {
-        auto view = write_buffer.malloc(msg.header().size());
-        auto size = write_buffer.readable_bytes();
-        bool func_found = true;
-        std::string func_name { msg.func_name() };
-        if (funcs.contains(func_name)) {
-            funcs[func_name](std::move(msg), write_buffer);
-        } else if (afuncs.contains(func_name)) {
-            co_await afuncs[func_name](std::move(msg), write_buffer);
+    /// copy the request header into out, the response echoes it and only
+    /// the body size changes
+    static std::span<char> write_header(const Message& msg, GrowableBuffer& out) noexcept {
+        auto header = msg.header();
+        auto view = out.malloc(header.size());
+        std::copy(header.begin(), header.end(), view.data());
+        return view;
+    }
+
+    static void patch_body_size(std::span<char> header, size_t body_size) noexcept {
+        Message::set_body_size(header, body_size);
+    }
+
+    /// patch the size of the body_size bytes last written to body, a body
+    /// too large for its header is dropped and the response marked
+    /// TOO_LARGE instead, false then
+    static bool patch_body_size(std::span<char> header, size_t body_size, GrowableBuffer& body) noexcept {
+        if (Message::set_body_size(header, body_size)) {
+            return true;
+        }
+        SPDLOG_WARN("drop response {} of {} bytes, too large for its frame", Message::id({ header.data(), header.size() }), body_size);
+        body.backup(body_size);
+        header[message::v2::FLAGS_POS] |= message::v2::TOO_LARGE;
+        patch_body_size(header, 0);
+        return false;
+    }
+
+    /// move the body a cached function wrote aside behind its header in out
+    /// and keep it for the requests to come
+    static void keep_response(
+        const DispatchTable::Entry& method,
+        std::string&& request,
+        GrowableBuffer& response,
+        GrowableBuffer& out,
+        ResponseCache& cache
+    ) noexcept {
+        auto body = response.read(response.readable_bytes());
+        if (!body.empty()) {
+            out.write(body);
+        }
+        cache.insert(method.id, std::move(request), body, Clock::now() + method.cache.ttl);
+    }
+
+    static void write_not_found(const Message& msg, GrowableBuffer& out) noexcept {
+        if (msg.indexed()) {
+            SPDLOG_INFO("function {} not registered yet", msg.method_id());
         } else {
-            func_found = false;
-            SPDLOG_INFO("function {} not registered yet", func_name);
+            SPDLOG_INFO("function {} not registered yet", msg.func_name());
         }
-        if (func_found) {
-            msg.body_size() = write_buffer.readable_bytes() - size;
-            std::copy(msg.header().begin(), msg.header().end(), view.data());
+        if (msg.v2()) {
+            // the status travels in the flags, the header stays as it was
+            auto view = write_header(msg, out);
+            view[message::v2::FLAGS_POS] |= message::v2::NOT_FOUND;
+            patch_body_size(view, 0);
+        } else if (msg.indexed()) {
+            auto view = write_header(msg, out);
+            auto method_id = Message::invalid_method;
+            std::copy((char*)&method_id, (char*)&method_id+sizeof(method_id), view.data()+msg.method_pos());
+            patch_body_size(view, 0);
         } else {
             auto id = msg.id();
-            write_buffer.backup(view.size());
-            write_buffer.write({ (const char*)&VERIFY_FLAG, sizeof(VERIFY_FLAG) });
-            write_buffer.write({ (const char*)&id, sizeof(id) });
-            write_buffer.write('\0');
+            out.write({ (const char*)&VERIFY_FLAG, sizeof(VERIFY_FLAG) });
+            out.write({ (const char*)&id, sizeof(id) });
+            out.write('\0');
+        }
+    }
+
+    /// answer the request whose header is header with a status and no
+    /// body, flag tells it in version 2 frames, method_id or name in version 1
+    /// frames by index or by name
+    static void write_status(
+        std::string_view header,
+        uint8_t flag,
+        Message::MethodID method_id,
+        std::string_view name,
+        GrowableBuffer& out
+    ) noexcept {
+        if (message::v2::is_v2(header)) {
+            auto view = out.malloc(header.size());
+            std::copy(header.begin(), header.end(), view.data());
+            view[message::v2::FLAGS_POS] |= flag;
+            patch_body_size(view, 0);
+        } else if (auto verify_flag = *(int16_t*)header.data(); Message::indexed(verify_flag)) {
+            auto view = out.malloc(header.size());
+            std::copy(header.begin(), header.end(), view.data());
+            std::copy((char*)&method_id, (char*)&method_id+sizeof(method_id), view.data()+Message::method_pos(verify_flag));
+            patch_body_size(view, 0);
+        } else {
+            auto id = Message::id(header);
+            size_t body_size = 0;
+            out.write({ (const char*)&VERIFY_FLAG, sizeof(VERIFY_FLAG) });
+            out.write({ (const char*)&id, sizeof(id) });
+            out.write(name);
+            out.write('\0');
+            out.write({ (const char*)&body_size, sizeof(body_size) });
+        }
+    }
+
+    /// answer msg without running it, so the caller backs off or goes elsewhere
+    static void write_overloaded(const Message& msg, GrowableBuffer& out) noexcept {
+        write_status(msg.header(), message::v2::OVERLOADED, Message::overloaded_method, OVERLOADED_NAME, out);
+    }
+
+    /// replace the response last written to out, header view and body_size
+    /// bytes of body, for a request whose arguments did not decode
+    static void write_bad_request(std::span<char> view, size_t body_size, GrowableBuffer& out) noexcept {
+        // view is overwritten, the header is rare enough to copy
+        std::string header(view.data(), view.size());
+        out.backup(view.size() + body_size);
+        write_status(header, message::v2::BAD_REQUEST, Message::bad_request_method, BAD_REQUEST_NAME, out);
+    }
+
+    /// answer a call reusing the id of one still in flight without running
+    /// it, neither its response nor a cancel could be told apart
+    static void write_duplicate(const Message& msg, GrowableBuffer& out) noexcept {
+        SPDLOG_DEBUG("reject message {}, its id is in flight", msg.id());
+        write_status(msg.header(), message::v2::BAD_REQUEST, Message::bad_request_method, BAD_REQUEST_NAME, out);
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    static void record(
+        MetricsShard::Method& metrics,
+        Clock::time_point received,
+        Clock::time_point start,
+        Clock::time_point end,
+        size_t bytes_out
+    ) noexcept {
+        metrics.queue_time.record(start - received);
+        metrics.handler_time.record(end - start);
+        MetricsShard::add(metrics.bytes_out, bytes_out);
+    }
+
+    /// a call that may suspend
+    struct Call {
+        std::optional<asyncio::Task<>> task {};
+        MetricsShard::Method* metrics;
+    };
+
+    /// state of one accepted connection, lives in handle_connection's frame
+    struct Connection {
+        MetricsShard& metrics;
+        MetricsShard::ConnectionHandle gauges;
+        // shared by the connections of an event loop
+        ResponseCache& cache;
+        AdmissionControl& admission;
+        WriteQueue write_queue {};
+        // sync cached functions write here first, see keep_response
+        GrowableBuffer response {};
+        asyncio::Event<bool> ev {};
+        // async calls in flight by request id, cancelled through CANCEL_FUNC
+        std::unordered_map<Message::ID, Call> inflight {};
+        // open streaming calls by request id
+        std::unordered_map<Message::ID, std::shared_ptr<Stream>> streams {};
+        // streams holding too many unread chunks, reading waits for them
+        StreamBacklog backlog {};
+        // calls dispatched but not answered yet, reading pauses at max_inflight
+        size_t pending { 0 };
+        size_t max_inflight { 0 };
+        asyncio::Event<> settled {};
+        // calls handed to workers, which cannot be cancelled, the connection
+        // outlives them
+        size_t offloaded { 0 };
+        asyncio::Event<> workers_done {};
+
+        Connection(MetricsShard& metrics, ResponseCache& cache, AdmissionControl& admission, int fd) noexcept:
+            metrics(metrics), gauges(metrics.open(fd)), cache(cache), admission(admission) {}
+        Connection(Connection&) = delete;
+        Connection& operator=(Connection&) = delete;
+        ~Connection() noexcept {
+            metrics.close(gauges);
+        }
+
+        inline void publish() noexcept {
+            MetricsShard::set(gauges->write_queued, write_queue.size());
+            MetricsShard::set(gauges->inflight, pending);
         }
-        if (!ev.is_set()) {
-            ev.set();
+
+        inline void notify() noexcept {
+            if (!ev.is_set()) {
+                ev.set();
+            }
+        }
+
+        inline void settle() noexcept {
+            MetricsShard::set(gauges->inflight, --pending);
+            if (pending < max_inflight && !settled.is_set()) {
+                settled.set();
+            }
+        }
+    };
+
+    asyncio::Task<> call_offloaded(
+        const DispatchTable::Entry& method,
+        Message msg,
+        Connection& conn,
+        [[maybe_unused]] AdmissionControl::Ticket ticket,
+        Clock::time_point received,
+        Clock::time_point deadline
+    ) noexcept {
+        // the worker builds the whole frame in its own buffer, the loop
+        // only queues it, so other responses keep flowing meanwhile. ticket
+        // frees the slot of the function once done
+        auto frame = conn.write_queue.acquire();
+        // the cache is only touched on the loop
+        auto cached = method.cache.enabled();
+        std::string request;
+        GrowableBuffer response;
+        if (cached) {
+            request.assign(msg.body());
+        }
+        // taken by the worker, the counters are only written on the loop
+        Clock::time_point start, end;
+        size_t body_size = 0;
+        bool decoded = true;
+        bool fits = true;
+        co_await workers->run([&] {
+            start = Clock::now();
+            if (start > deadline) {
+                SPDLOG_DEBUG("drop expired message {} queued for a worker", msg.id());
+                return;
+            }
+            auto view = write_header(msg, frame);
+            auto& out = cached ? response : frame;
+            auto size = out.readable_bytes();
+            decoded = method.handler(std::move(msg), out);
+            body_size = out.readable_bytes() - size;
+            if (decoded) {
+                fits = patch_body_size(view, body_size, out);
+            } else {
+                write_bad_request(view, cached ? 0 : body_size, frame);
+            }
+            end = Clock::now();
+        });
+        // waiting for a worker is queue delay as well
+        conn.admission.observe(start - received, Clock::now());
+        auto& metrics = conn.metrics.method(method.id);
+        if (start > deadline || !decoded || !fits) {
+            MetricsShard::add(metrics.errors);
+        } else {
+            record(metrics, received, start, end, body_size);
+            if (cached) {
+                keep_response(method, std::move(request), response, frame, conn.cache);
+            }
+        }
+        conn.write_queue.push(std::move(frame));
+        conn.notify();
+        conn.settle();
+        if (--conn.offloaded == 0 && !conn.workers_done.is_set()) {
+            conn.workers_done.set();
         }
     }
 
-    asyncio::Task<> handle_connection(int fd) noexcept {
-        char buffer[TINYRPC_DEFAULT_BUFFER_SIZE];
+    asyncio::Task<> call_async(
+        const DispatchTable::Entry& method,
+        Message msg,
+        Connection& conn,
+        [[maybe_unused]] AdmissionControl::Ticket ticket,
+        Clock::time_point received,
+        Clock::time_point start
+    ) noexcept {
+        // overlapping async calls of a connection never share a buffer,
+        // each frame is queued whole in completion order. ticket frees the
+        // slot of the function once done or cancelled
+        auto id = msg.id();
+        auto frame = conn.write_queue.acquire();
+        auto view = write_header(msg, frame);
+        auto& metrics = conn.metrics.method(method.id);
+        if (method.cache.enabled()) {
+            std::string request(msg.body());
+            GrowableBuffer response;
+            if (!co_await method.handler.call_async(std::move(msg), response)) {
+                write_bad_request(view, 0, frame);
+                MetricsShard::add(metrics.errors);
+            } else if (auto body_size = response.readable_bytes(); patch_body_size(view, body_size, response)) {
+                record(metrics, received, start, Clock::now(), body_size);
+                keep_response(method, std::move(request), response, frame, conn.cache);
+            } else {
+                MetricsShard::add(metrics.errors);
+            }
+        } else {
+            auto decoded = co_await method.handler.call_async(std::move(msg), frame);
+            auto body_size = frame.readable_bytes() - view.size();
+            if (!decoded) {
+                write_bad_request(view, body_size, frame);
+                MetricsShard::add(metrics.errors);
+            } else if (patch_body_size(view, body_size, frame)) {
+                record(metrics, received, start, Clock::now(), body_size);
+            } else {
+                MetricsShard::add(metrics.errors);
+            }
+        }
+        conn.write_queue.push(std::move(frame));
+        conn.notify();
+        conn.settle();
+        conn.inflight.erase(id);
+    }
+
+    asyncio::Task<> call_stream(
+        const DispatchTable::Entry& method,
+        std::shared_ptr<Stream> stream,
+        Connection& conn,
+        Clock::time_point received
+    ) noexcept {
+        auto id = stream->id();
+        auto start = Clock::now();
+        co_await method.handler.call_stream(*stream);
+        stream->stop_reading();
+        auto& metrics = conn.metrics.method(method.id);
+        MetricsShard::add(metrics.bytes_in, stream->bytes_read());
+        record(metrics, received, start, Clock::now(), stream->bytes_written());
+        stream->finish();
+        conn.settle();
+        if (stream->peer_finished()) {
+            conn.streams.erase(id);
+        }
+        conn.inflight.erase(id);
+    }
+
+    /// start a call that may suspend such that it can be cancelled by id,
+    /// start() returns its task, which removes itself once done. id must not
+    /// be in flight, an untracked call could outlive the connection
+    template<typename F>
+    static void spawn(Connection& conn, Message::ID id, MetricsShard::Method& metrics, F&& start) noexcept {
+        ++conn.pending;
+        conn.inflight.emplace(id, Call { .metrics = &metrics });
+        auto task = start();
+        // gone already if the call completed without suspending
+        if (auto it = conn.inflight.find(id); it != conn.inflight.end()) {
+            it->second.task = std::move(task);
+        }
+    }
+
+    void handle_message(Message msg, Connection& conn, Clock::time_point received, Clock::time_point deadline) noexcept {
+        auto method = find_method(msg);
+        if (!method || method->handler.is_stream()) {
+            conn.metrics.not_found();
+            write_not_found(msg, conn.write_queue.buffer());
+            conn.notify();
+            return;
+        }
+        auto& metrics = conn.metrics.method(method->id);
+        MetricsShard::add(metrics.calls);
+        MetricsShard::add(metrics.bytes_in, msg.body_size());
+        // earlier messages of the batch may have taken long
+        auto start = Clock::now();
+        if (start > deadline) {
+            SPDLOG_DEBUG("drop expired message {}", msg.id());
+            MetricsShard::add(metrics.errors);
+            return;
+        }
+        if (method->cache.enabled()) {
+            if (auto hit = conn.cache.find(method->id, msg.body(), start); hit) {
+                MetricsShard::add(metrics.cache_hits);
+                auto& write_buffer = conn.write_queue.buffer();
+                auto view = write_header(msg, write_buffer);
+                if (!hit->empty()) {
+                    write_buffer.write(*hit);
+                }
+                patch_body_size(view, hit->size());
+                record(metrics, received, start, Clock::now(), hit->size());
+                conn.notify();
+                return;
+            }
+        }
+        // cache hits are cheap enough to answer even while overloaded
+        auto ticket = conn.admission.admit(method->id, method->max_running, start - received, start);
+        if (!ticket) {
+            SPDLOG_DEBUG("shed message {}", msg.id());
+            MetricsShard::add(metrics.shed);
+            write_overloaded(msg, conn.write_queue.buffer());
+            conn.notify();
+            return;
+        }
+        if (method->execution == Execution::WorkerPool) {
+            ++conn.pending;
+            ++conn.offloaded;
+            call_offloaded(*method, std::move(msg), conn, std::move(*ticket), received, deadline);
+            return;
+        }
+        if (method->handler.is_async()) {
+            if (conn.inflight.contains(msg.id())) {
+                MetricsShard::add(metrics.errors);
+                write_duplicate(msg, conn.write_queue.buffer());
+                conn.notify();
+                return;
+            }
+            spawn(conn, msg.id(), metrics, [&] {
+                return call_async(*method, std::move(msg), conn, std::move(*ticket), received, start);
+            });
+            return;
+        }
+        auto& write_buffer = conn.write_queue.buffer();
+        auto view = write_header(msg, write_buffer);
+        if (method->cache.enabled()) {
+            std::string request(msg.body());
+            if (!method->handler(std::move(msg), conn.response)) {
+                write_bad_request(view, 0, write_buffer);
+                MetricsShard::add(metrics.errors);
+            } else if (auto body_size = conn.response.readable_bytes(); patch_body_size(view, body_size, conn.response)) {
+                record(metrics, received, start, Clock::now(), body_size);
+                keep_response(*method, std::move(request), conn.response, write_buffer, conn.cache);
+            } else {
+                MetricsShard::add(metrics.errors);
+            }
+        } else {
+            auto size = write_buffer.readable_bytes();
+            auto decoded = method->handler(std::move(msg), write_buffer);
+            auto body_size = write_buffer.readable_bytes() - size;
+            if (!decoded) {
+                write_bad_request(view, body_size, write_buffer);
+                MetricsShard::add(metrics.errors);
+            } else if (patch_body_size(view, body_size, write_buffer)) {
+                record(metrics, received, start, Clock::now(), body_size);
+            } else {
+                MetricsShard::add(metrics.errors);
+            }
+        }
+        conn.notify();
+    }
+
+    /// the first frame of a call opens its stream, later ones are chunks
+    void handle_stream(Message msg, Connection& conn, Clock::time_point received) noexcept {
+        auto id = msg.id();
+        if (auto it = conn.streams.find(id); it != conn.streams.end()) {
+            auto& stream = it->second;
+            stream->push(std::move(msg));
+            if (stream->finished() && stream->peer_finished()) {
+                conn.streams.erase(it);
+            }
+            return;
+        }
+        auto method = find_method(msg);
+        if (!method || !method->handler.is_stream()) {
+            conn.metrics.not_found();
+            write_not_found(msg, conn.write_queue.buffer());
+            conn.notify();
+            return;
+        }
+        auto& metrics = conn.metrics.method(method->id);
+        MetricsShard::add(metrics.calls);
+        if (conn.inflight.contains(id)) {
+            MetricsShard::add(metrics.errors);
+            write_duplicate(msg, conn.write_queue.buffer());
+            conn.notify();
+            return;
+        }
+        auto stream = std::make_shared<Stream>(
+            msg.header(),
+            conn.write_queue,
+            [&conn] { conn.notify(); },
+            conn.backlog,
+            options.max_stream_buffered
+        );
+        conn.streams.emplace(id, stream);
+        stream->push(std::move(msg));
+        spawn(conn, id, metrics, [&] {
+            return call_stream(*method, std::move(stream), conn, received);
+        });
+    }
+
+    static void cancel(const Message& msg, Connection& conn) noexcept {
+        Message::ID id;
+        auto body = msg.body();
+        if (body.size() != sizeof(id)) {
+            return;
+        }
+        std::copy(body.begin(), body.end(), (char*)&id);
+        if (auto it = conn.inflight.find(id); it != conn.inflight.end()) {
+            SPDLOG_DEBUG("cancel message {}", id);
+            auto& call = it->second;
+            if (call.task) {
+                call.task->cancel();
+            }
+            MetricsShard::add(call.metrics->errors);
+            conn.inflight.erase(it);
+            conn.settle();
+        }
+        if (auto it = conn.streams.find(id); it != conn.streams.end()) {
+            it->second->close();
+            conn.streams.erase(it);
+        }
+    }
+
+    asyncio::Task<> handle_connection(int fd, MetricsShard& metrics, ResponseCache& cache, AdmissionControl& admission) noexcept {
         asyncio::Socket sock(fd);
-        GrowableBuffer write_buffer;
+        Connection conn(metrics, cache, admission, fd);
         message::Parser message_parser;
-        asyncio::Event<bool> ev;
-        write_forever(sock, ev, write_buffer);
+        auto writer = write_forever(sock, conn.ev, conn.write_queue, *conn.gauges);
+        message_parser.set_recv_size(options.min_recv_size, options.max_recv_size);
+        message_parser.set_max_frame_size(options.max_frame_size);
+        conn.write_queue.set_watermarks(options.write_high_watermark, options.write_low_watermark);
+        conn.max_inflight = std::max<size_t>(options.max_inflight, 1);
+        std::vector<Message> msgs;
         while (true) {
-            auto res = co_await sock.read(buffer, TINYRPC_DEFAULT_BUFFER_SIZE);
-            if (!res) {
-                break;
+            // stop reading, and so let the peer block, while answers pile up
+            if (conn.write_queue.congested()) {
+                co_await conn.write_queue.drained();
             }
-            auto nbytes = *res;
-            SPDLOG_DEBUG(
-                "recv {} bytes data:{}",
-                nbytes,
-                spdlog::to_hex(std::span(buffer, (size_t)nbytes))
-            );
-            auto msgs = message_parser.process(buffer, nbytes);
+            while (conn.pending >= conn.max_inflight) {
+                co_await conn.settled.wait();
+            }
+            co_await conn.backlog.drained();
+            auto alive = co_await message_parser.read(sock, msgs);
+            auto received = Clock::now();
             for (auto& msg : msgs) {
-                handle_message(std::move(msg), write_buffer, ev);
+                if (!msg.indexed() && msg.func_name() == CANCEL_FUNC) {
+                    cancel(msg, conn);
+                    continue;
+                }
+                if (msg.stream()) {
+                    handle_stream(std::move(msg), conn, received);
+                    continue;
+                }
+                auto deadline = Clock::time_point::max();
+                if (msg.has_deadline()) {
+                    deadline = received + std::chrono::milliseconds(msg.timeout());
+                }
+                handle_message(std::move(msg), conn, received, deadline);
+            }
+            msgs.clear();
+            conn.publish();
+            if (!alive) {
+                break;
+            }
+        }
+        // nobody reads their responses anymore
+        for (auto& [_, call] : conn.inflight) {
+            if (call.task) {
+                call.task->cancel();
             }
         }
+        for (auto& [_, stream] : conn.streams) {
+            stream->close();
+        }
+        // a worker may still be running, its call resumes into conn
+        while (conn.offloaded > 0) {
+            co_await conn.workers_done.wait();
+        }
+        // the writer holds the socket, queue and gauges of conn, all of
+        // which go with this frame
+        conn.ev.set(true);
+        co_await writer;
+    }
+
+    static void reuse_port(asyncio::Socket& sock) noexcept {
+        int on = 1;
+        if (setsockopt(sock.fd(), SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+            std::perror("failed to set SO_REUSEPORT");
+        }
     }
 
     void init(const char* host, short port, int max_listen_num) noexcept {
+        this->host = host;
+        this->port = port;
+        this->max_listen_num = max_listen_num;
+        if (auto path = unix_path(host); path) {
+            auto fd = listen_unix(*path, max_listen_num);
+            if (fd == -1) {
+                std::perror(std::format("failed to listen on {}", host).c_str());
+                exit(EXIT_FAILURE);
+            }
+            sock = asyncio::Socket(fd);
+            SPDLOG_INFO("start listenning on {}, listen number: {}", host, max_listen_num);
+            return;
+        }
+        // lets every event loop of serve() bind its own listener
+        reuse_port(sock);
         auto res = sock.bind(host, port);
         if (res == -1) {
             std::perror("failed to bind");
@@ -133,16 +698,136 @@ struct Server::impl {
         SPDLOG_INFO("start listenning, listen number: {}", max_listen_num);
     }
 
-    asyncio::Task<> run() noexcept {
+    asyncio::Task<> accept_forever(asyncio::Socket& listener) noexcept {
+        // the table is frozen by now
+        auto& shard = metrics.add_shard(table.entries().size());
+        auto cached = std::ranges::any_of(table.entries(), [](auto& entry) {
+            return entry.cache.enabled();
+        });
+        // per loop like the metrics, so neither is ever locked
+        ResponseCache cache(cached ? response_cache_size : 0);
+        AdmissionControl admission(admission_options, table.entries().size());
         while (true) {
-            auto conn = co_await sock.accept();
-            handle_connection(conn);
+            auto conn = co_await listener.accept();
+            handle_connection(conn, shard, cache, admission);
+        }
+    }
+
+    /// freeze the table and create the workers, only the first call does
+    void start() noexcept {
+        std::call_once(started, [this] {
+            table.freeze();
+            auto offloaded = std::ranges::any_of(table.entries(), [](auto& entry) {
+                return entry.execution == Execution::WorkerPool;
+            });
+            if (offloaded) {
+                workers = std::make_unique<ThreadPool>(std::max<size_t>(thread_pool_size, 1));
+            }
+        });
+    }
+
+    MetricsShard& local_shard() noexcept override {
+        // every thread writes to a shard of its own, as event loops do
+        std::lock_guard lock(local_mutex);
+        auto& shard = local_shards[std::this_thread::get_id()];
+        if (!shard) {
+            shard = &metrics.add_shard(table.entries().size());
         }
+        return *shard;
+    }
+
+    /// run method where a connection would, without a deadline
+    template<typename Sync, typename Async>
+    asyncio::Task<> call_local(const DispatchTable::Entry& method, Sync&& sync, Async&& async) noexcept {
+        if (method.execution == Execution::WorkerPool) {
+            co_await workers->run(sync);
+        } else if (method.handler.is_async()) {
+            co_await async();
+        } else {
+            sync();
+        }
+    }
+
+    asyncio::Task<LocalStatus> call(Message&& request, GrowableBuffer& out, MetricsShard& shard) noexcept override {
+        auto method = find_method(request);
+        if (!method || method->handler.is_stream()) {
+            shard.not_found();
+            co_return LocalStatus::NotFound;
+        }
+        auto& metrics = shard.method(method->id);
+        MetricsShard::add(metrics.calls);
+        MetricsShard::add(metrics.bytes_in, request.body_size());
+        auto size = out.readable_bytes();
+        auto start = Clock::now();
+        bool decoded;
+        co_await call_local(
+            *method,
+            [&] { decoded = method->handler(std::move(request), out); },
+            [&]() -> asyncio::Task<> { decoded = co_await method->handler.call_async(std::move(request), out); }
+        );
+        if (!decoded) {
+            MetricsShard::add(metrics.errors);
+            co_return LocalStatus::BadRequest;
+        }
+        record(metrics, start, start, Clock::now(), out.readable_bytes() - size);
+        co_return LocalStatus::Ok;
+    }
+
+    const DispatchTable::Entry* find_direct(std::string_view name, const std::type_info& signature) const noexcept override {
+        auto method = table.find(name);
+        return method && method->handler.direct(signature) ? method : nullptr;
+    }
+
+    asyncio::Task<> call_direct(const DispatchTable::Entry& method, DirectCall call, MetricsShard& shard) noexcept override {
+        auto& metrics = shard.method(method.id);
+        MetricsShard::add(metrics.calls);
+        auto start = Clock::now();
+        co_await call_local(
+            method,
+            [&] { method.handler.call_direct(call); },
+            [&] { return method.handler.call_direct_async(call); }
+        );
+        record(metrics, start, start, Clock::now(), 0);
+    }
+
+    asyncio::Task<> run() noexcept {
+        start();
+        co_await accept_forever(sock);
+    }
+
+    void serve(size_t num_loops) noexcept {
+        start();
+        std::vector<std::jthread> loops;
+        for (size_t i = 1; i < num_loops; ++i) {
+            loops.emplace_back([this, i] {
+                if (unix_path(host)) {
+                    // SO_REUSEPORT does not shard unix sockets, the loops
+                    // accept from the one listener instead
+                    asyncio::Socket listener(::dup(sock.fd()));
+                    SPDLOG_INFO("event loop {} start accepting on {}", i, host);
+                    asyncio::run(accept_forever(listener));
+                    return;
+                }
+                asyncio::Socket listener;
+                reuse_port(listener);
+                if (listener.bind(host.c_str(), port) == -1 || listener.listen(max_listen_num) == -1) {
+                    std::perror(std::format("event loop {} failed to listen", i).c_str());
+                    return;
+                }
+                SPDLOG_INFO("event loop {} start listenning on {}:{}", i, host, port);
+                asyncio::run(accept_forever(listener));
+            });
+        }
+        asyncio::run(accept_forever(sock));
     }
 };
 
 
-Server::Server() noexcept: _pimpl(new impl()) {}
+Server::Server() noexcept: _pimpl(new impl()) {
+    TINYRPC_NS::register_func(*this, std::string(STATS_FUNC), std::function<ServerStats()>([impl = _pimpl] {
+        return impl->metrics.snapshot(impl->table);
+    }));
+}
 
 Server::Server(Server&& server) noexcept: _pimpl(std::exchange(server._pimpl, nullptr)) {}
 
@@ -153,11 +838,41 @@ Server& Server::operator=(Server&& server) noexcept {
 }
 
 void Server::register_func(const std::string& name, Function&& func) noexcept {
-    _pimpl->register_func(name, std::move(func));
+    _pimpl->register_handler(name, Handler::sync(std::move(func)));
 }
 
 void Server::register_afunc(const std::string& name, AFunction&& afunc) noexcept {
-    _pimpl->register_afunc(name, std::move(afunc));
+    _pimpl->register_handler(name, Handler::async(std::move(afunc)));
+}
+
+void Server::register_stream(const std::string& name, StreamFunction&& func) noexcept {
+    _pimpl->register_handler(name, Handler::stream(std::move(func)));
+}
+
+void Server::register_handler(const std::string& name, Handler&& handler, Execution execution, CachePolicy cache) noexcept {
+    _pimpl->register_handler(name, std::move(handler), execution, cache);
+}
+
+void Server::set_options(const ConnectionOptions& options) noexcept {
+    _pimpl->options = options;
+}
+
+void Server::set_thread_pool_size(size_t size) noexcept {
+    _pimpl->thread_pool_size = size;
+}
+
+void Server::set_response_cache_size(size_t bytes) noexcept {
+    _pimpl->response_cache_size = bytes;
+}
+
+void Server::set_admission(const AdmissionOptions& options) noexcept {
+    _pimpl->admission_options = options;
+}
+
+void Server::limit(const std::string& name, size_t max_running) noexcept {
+    if (!_pimpl->table.limit(name, max_running)) {
+        SPDLOG_WARN("failed to limit function {}, it is not registered or the server is running", name);
+    }
 }
 
 void Server::init(const char* host, short port, int max_listen_num) noexcept {
@@ -168,4 +883,13 @@ asyncio::Task<> Server::run() noexcept {
     return _pimpl->run();
 }
 
+void Server::serve(size_t num_loops) noexcept {
+    _pimpl->serve(num_loops);
+}
+
+LocalEndpoint& Server::local() noexcept {
+    _pimpl->start();
+    return *_pimpl;
+}
+
 TINYRPC_NS_END
@@ -0,0 +1,156 @@
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "tinyrpc/stream.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+asyncio::Task<> StreamBacklog::drained() noexcept {
+    while (true) {
+        std::erase_if(_streams, [](auto& weak) {
+            auto stream = weak.lock();
+            return !stream || !stream->backlogged();
+        });
+        if (_streams.empty()) {
+            co_return;
+        }
+        co_await _ev.wait();
+    }
+}
+
+Stream::Stream(
+    std::string_view header,
+    WriteQueue& queue,
+    Wake&& wake,
+    StreamBacklog& backlog,
+    size_t max_buffered
+) noexcept: _header(header), _queue(&queue), _wake(std::move(wake)), _backlog(&backlog), _max_buffered(max_buffered) {
+    Message::set_stream(_header);
+}
+
+Stream::~Stream() noexcept {
+    if (backlogged()) {
+        _backlog->notify();
+    }
+    if (_done) {
+        _done();
+    }
+}
+
+void Stream::check_done() noexcept {
+    if (_finished && _peer_finished && _done) {
+        // at most once, done may drop the last other reference to this
+        std::exchange(_done, {})();
+    }
+}
+
+asyncio::Task<std::optional<Message>> Stream::read() noexcept {
+    while (_chunks.empty()) {
+        if (_peer_finished) {
+            co_return std::nullopt;
+        }
+        co_await _ev.wait();
+    }
+    auto msg = std::move(_chunks.front());
+    _chunks.pop_front();
+    auto was_backlogged = backlogged();
+    _buffered -= msg.body_size();
+    if (was_backlogged && !backlogged()) {
+        _backlog->notify();
+    }
+    co_return std::move(msg);
+}
+
+void Stream::stop_reading() noexcept {
+    auto was_backlogged = backlogged();
+    _reading = false;
+    _chunks.clear();
+    _buffered = 0;
+    if (was_backlogged) {
+        _backlog->notify();
+    }
+}
+
+void Stream::write_frame(std::string_view chunk) noexcept {
+    auto& out = _queue->buffer();
+    auto header = out.malloc(_header.size());
+    std::copy(_header.begin(), _header.end(), header.data());
+    Message::set_body_size(header, chunk.size());
+    if (!chunk.empty()) {
+        out.write(chunk);
+    }
+    _wake();
+}
+
+bool Stream::write(std::string_view chunk) noexcept {
+    if (_finished || chunk.size() > Message::max_body_size(_header)) {
+        return false;
+    }
+    if (!chunk.empty()) {
+        _bytes_written += chunk.size();
+        write_frame(chunk);
+    }
+    return true;
+}
+
+asyncio::Task<> Stream::drained() noexcept {
+    if (!_finished && _queue->congested()) {
+        _wake();
+        co_await _queue->drained();
+    }
+}
+
+void Stream::finish() noexcept {
+    if (_finished) {
+        return;
+    }
+    _finished = true;
+    write_frame({});
+    check_done();
+}
+
+void Stream::push(Message&& msg) noexcept {
+    if (_peer_finished) {
+        SPDLOG_WARN("drop chunk of stream {} which already ended", id());
+        return;
+    }
+    auto was_backlogged = backlogged();
+    if (!msg.stream()) {
+        // the peer answered with a plain frame, which means not found
+        _not_found = msg.func_not_found();
+        _peer_finished = true;
+    } else if (msg.body_size() == 0) {
+        _peer_finished = true;
+    } else {
+        _bytes_read += msg.body_size();
+        if (_reading) {
+            _buffered += msg.body_size();
+            _chunks.push_back(std::move(msg));
+        }
+    }
+    if (!was_backlogged && backlogged()) {
+        _backlog->add(weak_from_this());
+    } else if (was_backlogged && !backlogged()) {
+        _backlog->notify();
+    }
+    if (!_ev.is_set()) {
+        _ev.set();
+    }
+    check_done();
+}
+
+void Stream::close() noexcept {
+    if (backlogged()) {
+        _backlog->notify();
+    }
+    _finished = true;
+    _peer_finished = true;
+    if (!_ev.is_set()) {
+        _ev.set();
+    }
+    check_done();
+}
+
+TINYRPC_NS_END
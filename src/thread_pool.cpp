@@ -0,0 +1,104 @@
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "tinyrpc/thread_pool.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+Mailbox& Mailbox::current() noexcept {
+    thread_local Mailbox mailbox;
+    return mailbox;
+}
+
+Mailbox::Mailbox() noexcept: _fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (_fd == -1) {
+        std::perror("failed to create eventfd");
+        exit(EXIT_FAILURE);
+    }
+    // lives as long as the event loop of this thread
+    drain_forever();
+}
+
+void Mailbox::post(Callback&& callback) noexcept {
+    bool notify;
+    {
+        std::lock_guard lock(_mutex);
+        _callbacks.push_back(std::move(callback));
+        notify = !std::exchange(_notified, true);
+    }
+    if (notify) {
+        uint64_t one = 1;
+        while (::write(_fd, &one, sizeof(one)) == -1 && errno == EINTR);
+    }
+}
+
+asyncio::Task<> Mailbox::drain_forever() noexcept {
+    // the socket owns the eventfd from here on
+    asyncio::Socket sock(_fd);
+    std::vector<Callback> callbacks;
+    uint64_t counter;
+    while (true) {
+        auto res = co_await sock.read((char*)&counter, sizeof(counter));
+        if (!res) {
+            SPDLOG_ERROR("error while read from eventfd {}: {}", _fd, res.error());
+            break;
+        }
+        {
+            std::lock_guard lock(_mutex);
+            std::swap(callbacks, _callbacks);
+            _notified = false;
+        }
+        for (auto& callback : callbacks) {
+            callback();
+        }
+        callbacks.clear();
+    }
+}
+
+
+ThreadPool::ThreadPool(size_t size) noexcept {
+    for (size_t i = 0; i < size; ++i) {
+        _workers.emplace_back([this] { work(); });
+    }
+    SPDLOG_INFO("start thread pool with {} workers", size);
+}
+
+ThreadPool::~ThreadPool() noexcept {
+    {
+        std::lock_guard lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(Job&& job) noexcept {
+    {
+        std::lock_guard lock(_mutex);
+        _jobs.push_back(std::move(job));
+    }
+    _cv.notify_one();
+}
+
+void ThreadPool::work() noexcept {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [this] { return _stop || !_jobs.empty(); });
+            if (_jobs.empty()) {
+                break;
+            }
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+        }
+        job();
+    }
+}
+
+TINYRPC_NS_END
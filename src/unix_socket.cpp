@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "tinyrpc/unix_socket.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+namespace {
+
+/// fills addr, the returned length is 0 if path does not fit
+socklen_t make_address(std::string_view path, sockaddr_un& addr) noexcept {
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        return 0;
+    }
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    if (path.front() == '@') {
+        // abstract names are not NUL terminated, their length is the size
+        addr.sun_path[0] = '\0';
+        return offsetof(sockaddr_un, sun_path) + path.size();
+    }
+    return sizeof(addr);
+}
+
+int open_socket() noexcept {
+    return ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+}
+
+}
+
+
+int listen_unix(std::string_view path, int backlog) noexcept {
+    sockaddr_un addr;
+    auto len = make_address(path, addr);
+    if (len == 0) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    // left behind by a server that did not shut down, only sockets are
+    // removed so a mistyped path cannot delete a regular file
+    struct stat st;
+    if (addr.sun_path[0] != '\0' && ::stat(addr.sun_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        // nobody listens on a stale one, a live server takes the connection
+        // or at worst has a full backlog
+        auto probe = open_socket();
+        if (probe == -1) {
+            return -1;
+        }
+        auto res = ::connect(probe, (sockaddr*)&addr, len);
+        auto err = errno;
+        ::close(probe);
+        if (res == 0 || (err != ECONNREFUSED && err != ENOENT)) {
+            errno = EADDRINUSE;
+            return -1;
+        }
+        ::unlink(addr.sun_path);
+    }
+    auto fd = open_socket();
+    if (fd == -1) {
+        return -1;
+    }
+    if (::bind(fd, (sockaddr*)&addr, len) == -1 || ::listen(fd, backlog) == -1) {
+        auto err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+int connect_unix(std::string_view path) noexcept {
+    sockaddr_un addr;
+    auto len = make_address(path, addr);
+    if (len == 0) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    auto fd = open_socket();
+    if (fd == -1) {
+        return -1;
+    }
+    if (::connect(fd, (sockaddr*)&addr, len) == -1) {
+        auto err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+TINYRPC_NS_END
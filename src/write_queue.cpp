@@ -0,0 +1,120 @@
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <spdlog/spdlog.h>
+
+#include "tinyrpc/write_queue.hpp"
+
+
+TINYRPC_NS_BEGIN()
+
+// regions handed to a single sendmsg, well below IOV_MAX
+static constexpr size_t max_iov_count = 64;
+static constexpr size_t max_spare_buffers = 32;
+
+
+void WriteQueue::push(GrowableBuffer&& buffer) noexcept {
+    if (buffer.readable_bytes() == 0) {
+        return;
+    }
+    // the view stays valid since nothing writes to a queued buffer
+    auto& pending = _pending.emplace_back(std::move(buffer));
+    pending.data = pending.buffer.read(pending.buffer.readable_bytes());
+    _queued += pending.data.size();
+}
+
+GrowableBuffer WriteQueue::acquire() noexcept {
+    if (_spare.empty()) {
+        return {};
+    }
+    auto buffer = std::move(_spare.back());
+    _spare.pop_back();
+    return buffer;
+}
+
+void WriteQueue::seal() noexcept {
+    if (_open.readable_bytes() == 0) {
+        return;
+    }
+    push(std::exchange(_open, acquire()));
+}
+
+void WriteQueue::consume(size_t nbytes) noexcept {
+    _queued -= nbytes;
+    while (nbytes > 0) {
+        auto& front = _pending.front();
+        if (nbytes < front.data.size()) {
+            front.data.remove_prefix(nbytes);
+            break;
+        }
+        nbytes -= front.data.size();
+        if (_spare.size() < max_spare_buffers) {
+            _spare.push_back(std::move(front.buffer));
+        }
+        _pending.pop_front();
+    }
+    if (size() <= _low && !_drained.is_set()) {
+        _drained.set();
+    }
+}
+
+void WriteQueue::clear() noexcept {
+    _pending.clear();
+    _queued = 0;
+    _open = {};
+    if (!_drained.is_set()) {
+        _drained.set();
+    }
+}
+
+asyncio::Task<> WriteQueue::drained() noexcept {
+    while (size() > _low) {
+        co_await _drained.wait();
+    }
+}
+
+asyncio::Task<bool> WriteQueue::flush(asyncio::Socket& sock) noexcept {
+    seal();
+    while (!_pending.empty()) {
+        iovec iov[max_iov_count];
+        size_t count = 0;
+        for (auto it = _pending.begin(); it != _pending.end() && count < max_iov_count; ++it, ++count) {
+            iov[count].iov_base = (void*)it->data.data();
+            iov[count].iov_len = it->data.size();
+        }
+        msghdr header {};
+        header.msg_iov = iov;
+        header.msg_iovlen = count;
+        // MSG_DONTWAIT keeps this non-blocking whatever mode the fd is in
+        auto nbytes = ::sendmsg(sock.fd(), &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (nbytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                SPDLOG_ERROR("error while write to fd {}: {}", sock.fd(), std::strerror(errno));
+                co_return false;
+            }
+            // socket buffer is full, let the event loop wait until writable
+            auto data = _pending.front().data;
+            auto res = co_await sock.write(data.data(), data.size());
+            if (!res) {
+                SPDLOG_ERROR("error while write to fd {}: {}", sock.fd(), res.error());
+                co_return false;
+            }
+            nbytes = *res;
+        }
+        SPDLOG_DEBUG(
+            "write {} bytes data to fd {} in {} regions",
+            nbytes,
+            sock.fd(),
+            count
+        );
+        consume(nbytes);
+    }
+    co_return true;
+}
+
+TINYRPC_NS_END
@@ -11,21 +11,67 @@ ASYNCIO_NS::Task<> add() {
     co_await c.connect("127.0.0.1", 12345);
     auto res1 = co_await TINYRPC_NS::call_func<int>(c, "add", 1, 3);
     std::cout << "1 + 3 = " << *res1 << std::endl;
+    // all three requests leave in one flush
+    auto sums = TINYRPC_NS::call_many<int>(c, "add", std::vector<std::tuple<int, int>> { { 1, 2 }, { 3, 4 }, { 5, 6 } });
+    for (auto& sum : sums) {
+        std::cout << *(co_await std::move(sum)) << std::endl;
+    }
     auto value = co_await TINYRPC_NS::call_func<int>(c, "get_value");
     std::cout << *value << std::endl;
+    // started together, only the first one sends a request
+    c.coalesce("get_value");
+    auto first = TINYRPC_NS::call_func<int>(c, "get_value");
+    auto second = TINYRPC_NS::call_func<int>(c, "get_value");
+    std::cout << *(co_await std::move(first)) << " " << *(co_await std::move(second)) << std::endl;
+    auto fib = co_await TINYRPC_NS::call_func<uint64_t>(c, "fib", 30);
+    std::cout << "fib(30) = " << *fib << std::endl;
+    // call by index from here on
+    co_await c.fetch_method_table();
     co_await TINYRPC_NS::call_func<void>(c, "hello");
     std::string name = "kewuaa";
     co_await TINYRPC_NS::call_func<void>(c, "hello_to", name);
+    auto count = co_await TINYRPC_NS::call_func<size_t>(c, "count_char", name, 'a');
+    std::cout << "count of a: " << *count << std::endl;
+    count = co_await TINYRPC_NS::call_func<size_t>(c, "count_char", name, 'a');
+    std::cout << "cached count of a: " << *count << std::endl;
     test_rpc::Msg msg;
     msg.set_query("query body");
     msg.set_page_number(999);
     co_await TINYRPC_NS::call_func<void>(c, "test_proto", msg);
     msg = *(co_await TINYRPC_NS::call_func<test_rpc::Msg>(c, "return_proto"));
     std::cout << msg.page_number() << std::endl;
+    msg = *(co_await TINYRPC_NS::call_func<test_rpc::Msg>(c, "next_page", msg));
+    std::cout << msg.page_number() << std::endl;
     co_await TINYRPC_NS::call_func<void>(c, "test_async");
     value = co_await TINYRPC_NS::call_func<int>(c, "test_async_return");
     std::cout << *value << std::endl;
     co_await TINYRPC_NS::call_func<void>(c, "async_hello_to", name);
+    // the follower gives up on its own while the shared request goes on
+    c.coalesce("test_async_return");
+    auto leader = TINYRPC_NS::call_func<int>(c, "test_async_return");
+    auto follower = co_await TINYRPC_NS::call_func<int>(c, std::chrono::milliseconds(100), "test_async_return");
+    if (!follower && follower.error() == TINYRPC_NS::RPCError::Timeout) {
+        std::cout << "coalesced test_async_return timed out, leader got " << *(co_await std::move(leader)) << std::endl;
+    }
+    // the leader gives up first, the follower sends the request again
+    auto impatient = TINYRPC_NS::call_func<int>(c, std::chrono::milliseconds(100), "test_async_return");
+    auto patient = co_await TINYRPC_NS::call_func<int>(c, "test_async_return");
+    if (!(co_await std::move(impatient)) && patient) {
+        std::cout << "coalesced test_async_return retried, follower got " << *patient << std::endl;
+    }
+    // gives up long before test_async is done, the server cancels it
+    auto timed = co_await TINYRPC_NS::call_func<void>(c, std::chrono::milliseconds(100), "test_async");
+    if (!timed && timed.error() == TINYRPC_NS::RPCError::Timeout) {
+        std::cout << "test_async timed out" << std::endl;
+    }
+    auto stream = c.open_stream("echo_stream");
+    for (auto word : { "streamed", "chunk", "by", "chunk" }) {
+        stream->write(word);
+    }
+    stream->finish();
+    while (auto chunk = co_await stream->read()) {
+        std::cout << chunk->body() << std::endl;
+    }
     auto res = co_await TINYRPC_NS::call_func<void>(c, "test_no_exist_func");
     if (!res) {
         switch (res.error()) {
@@ -37,8 +83,42 @@ ASYNCIO_NS::Task<> add() {
                 std::cout << "function not found" << std::endl;
                 break;
             }
+            case TINYRPC_NS::RPCError::Timeout: {
+                std::cout << "timeout" << std::endl;
+                break;
+            }
+            case TINYRPC_NS::RPCError::Overloaded: {
+                std::cout << "overloaded" << std::endl;
+                break;
+            }
+            case TINYRPC_NS::RPCError::BadRequest: {
+                std::cout << "bad request" << std::endl;
+                break;
+            }
+            case TINYRPC_NS::RPCError::DecodeError: {
+                std::cout << "decode error" << std::endl;
+                break;
+            }
+            case TINYRPC_NS::RPCError::TooLarge: {
+                std::cout << "too large" << std::endl;
+                break;
+            }
         }
     }
+    // add takes two ints, the server answers without calling it
+    auto bad = co_await TINYRPC_NS::call_func<int>(c, "add", std::string("one"), 3);
+    if (!bad && bad.error() == TINYRPC_NS::RPCError::BadRequest) {
+        std::cout << "add rejected a string" << std::endl;
+    }
+    // get_value returns an int, which does not decode as a string
+    auto wrong = co_await TINYRPC_NS::call_func<std::string>(c, "get_value");
+    if (!wrong && wrong.error() == TINYRPC_NS::RPCError::DecodeError) {
+        std::cout << "get_value is no string" << std::endl;
+    }
+    auto stats = co_await TINYRPC_NS::call_func<TINYRPC_NS::ServerStats>(c, TINYRPC_NS::STATS_FUNC);
+    for (auto& method : stats->methods) {
+        std::cout << method.name << ": " << method.calls << " calls, " << method.errors << " errors" << std::endl;
+    }
 }
 
 
@@ -23,6 +23,18 @@ void hello_to(const std::string& name) {
 }
 
 
+// cpu heavy, run by the worker pool to keep the event loop responsive
+uint64_t fib(int n) {
+    return n < 2 ? n : fib(n-1) + fib(n-2);
+}
+
+
+// text views into the request body, nothing is copied
+size_t count_char(std::string_view text, char c) {
+    return std::ranges::count(text, c);
+}
+
+
 void test_proto(const test_rpc::Msg& msg) {
     std::cout << msg.query() << std::endl;
 }
@@ -36,6 +48,15 @@ test_rpc::Msg return_proto() {
 }
 
 
+// parsed onto and answered from the arena of the request
+test_rpc::Msg* next_page(const test_rpc::Msg* msg, google::protobuf::Arena* arena) {
+    auto res = google::protobuf::Arena::Create<test_rpc::Msg>(arena);
+    res->set_query(msg->query());
+    res->set_page_number(msg->page_number()+1);
+    return res;
+}
+
+
 ASYNCIO_NS::Task<> test_async() {
     std::cout << "sleep 1000" << std::endl;
     co_await ASYNCIO_NS::sleep<1000>();
@@ -57,6 +78,32 @@ ASYNCIO_NS::Task<> async_hello_to(std::string name) {
 }
 
 
+// echoes every chunk of the caller back
+ASYNCIO_NS::Task<> echo_stream(TINYRPC_NS::Stream& stream) {
+    while (auto chunk = co_await stream.read()) {
+        stream.write(chunk->body());
+        co_await stream.drained();
+    }
+}
+
+
+// a client in the same process, add gets its arguments straight while the
+// const char* given to hello_to does not match and is encoded
+ASYNCIO_NS::Task<> local_calls(TINYRPC_NS::Server& server) {
+    TINYRPC_NS::Client c;
+    c.connect(server.local());
+    auto sum = co_await TINYRPC_NS::call_func<int>(c, "add", 1, 3);
+    std::cout << "local 1 + 3 = " << *sum << std::endl;
+    co_await TINYRPC_NS::call_func<void>(c, "hello_to", "local");
+}
+
+
+ASYNCIO_NS::Task<> serve(TINYRPC_NS::Server& server) {
+    co_await local_calls(server);
+    co_await server.run();
+}
+
+
 int main() {
 #if _DEBUG
     spdlog::set_level(spdlog::level::debug);
@@ -67,10 +114,17 @@ int main() {
     TINYRPC_NS::register_func(server, "get_value", get_value);
     TINYRPC_NS::register_func(server, "hello", hello);
     TINYRPC_NS::register_func(server, "hello_to", hello_to);
+    TINYRPC_NS::register_func(server, "fib", fib, TINYRPC_NS::Execution::WorkerPool);
+    // pure, repeated requests are answered from the cache
+    TINYRPC_NS::register_func(server, "count_char", count_char, TINYRPC_NS::Execution::Inline, { std::chrono::seconds(10) });
     TINYRPC_NS::register_func(server, "test_proto", test_proto);
     TINYRPC_NS::register_func(server, "return_proto", return_proto);
+    TINYRPC_NS::register_func(server, "next_page", next_page);
     TINYRPC_NS::register_func(server, "test_async", test_async);
+    // slow, more callers at once than this are told to back off
+    server.limit("test_async", 64);
     TINYRPC_NS::register_func(server, "test_async_return", test_async_return);
     TINYRPC_NS::register_func(server, "async_hello_to", async_hello_to);
-    ASYNCIO_NS::run(server.run());
+    server.register_stream("echo_stream", echo_stream);
+    ASYNCIO_NS::run(serve(server));
 }